@@ -0,0 +1,90 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "arena.h"
+
+/* Set of lattice positions (i*size + j) with O(1) insert, erase and
+ * lookup. Members are kept densely in a vector, an index grid on the
+ * arena maps each position to its slot (0 means absent). The order of
+ * items() changes with every erase, rules whose result depends on the
+ * visiting order iterate sorted(). */
+class ActiveSet {
+	public:
+		void map_fields(Arena& arena, size_t rows, size_t cols) {
+			n = cols;
+			index = arena.grid<uint32_t>(rows, cols);
+		}
+
+		bool contains(uint32_t pos) const {
+			return index[pos / n][pos % n] != 0;
+		}
+
+		void insert(uint32_t pos) {
+			uint32_t& slot = index[pos / n][pos % n];
+			if(slot == 0) {
+				list.push_back(pos);
+				slot = static_cast<uint32_t>(list.size());
+			}
+		}
+
+		void erase(uint32_t pos) {
+			uint32_t& slot = index[pos / n][pos % n];
+			if(slot != 0) {
+				uint32_t last = list.back();
+				list[slot - 1] = last;
+				index[last / n][last % n] = slot;
+				list.pop_back();
+				slot = 0;
+			}
+		}
+
+		/* move a member to a position outside the set */
+		void move(uint32_t from, uint32_t to) {
+			uint32_t slot = index[from / n][from % n];
+			index[from / n][from % n] = 0;
+			list[slot - 1] = to;
+			index[to / n][to % n] = slot;
+		}
+
+		/* Move several members at once. Targets are distinct and outside
+		 * the set once all moves are done, but a target may be the source
+		 * of another move, so all sources are vacated first. */
+		void move(const std::vector<std::pair<uint32_t, uint32_t>>& moves) {
+			std::vector<uint32_t> slots;
+			slots.reserve(moves.size());
+
+			for(auto const& m : moves) {
+				uint32_t& slot = index[m.first / n][m.first % n];
+				slots.push_back(slot);
+				slot = 0;
+			}
+			for(size_t k = 0; k < moves.size(); ++k) {
+				uint32_t to = moves[k].second;
+				list[slots[k] - 1] = to;
+				index[to / n][to % n] = slots[k];
+			}
+		}
+
+		/* replace the members, the index grid is expected to match them */
+		void assign(const std::vector<uint32_t>& items) {
+			list = items;
+		}
+
+		size_t size() const { return list.size(); }
+		const std::vector<uint32_t>& items() const { return list; }
+
+		/* members in row-major order */
+		std::vector<uint32_t> sorted() const {
+			std::vector<uint32_t> s = list;
+			std::sort(s.begin(), s.end());
+			return s;
+		}
+
+	private:
+		size_t n = 0;
+		Grid<uint32_t> index;
+		std::vector<uint32_t> list;
+};
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+/* Row-major 2D view into a field owned by an Arena */
+template<class T>
+class Grid {
+	public:
+		Grid() : ptr(nullptr), n_rows(0), n_cols(0), row_stride(0) {}
+		Grid(T* ptr, size_t rows, size_t cols, size_t stride) :
+			ptr(ptr), n_rows(rows), n_cols(cols), row_stride(stride) {}
+
+		T* operator[](size_t i) { return ptr + i * row_stride; }
+		const T* operator[](size_t i) const { return ptr + i * row_stride; }
+
+		T* data() { return ptr; }
+		const T* data() const { return ptr; }
+		size_t rows() const { return n_rows; }
+		size_t cols() const { return n_cols; }
+		size_t stride() const { return row_stride; }
+		size_t bytes() const { return n_rows * row_stride * sizeof(T); }
+
+		void swap(Grid& other) {
+			std::swap(ptr, other.ptr);
+			std::swap(n_rows, other.n_rows);
+			std::swap(n_cols, other.n_cols);
+			std::swap(row_stride, other.row_stride);
+		}
+
+	private:
+		T* ptr;
+		size_t n_rows;
+		size_t n_cols;
+		size_t row_stride;
+};
+
+/* One bit per lattice site, rows packed into 64 bit words */
+class BitGrid {
+	public:
+		BitGrid() {}
+		explicit BitGrid(Grid<uint64_t> words) : words(words) {}
+
+		bool test(size_t i, size_t j) const { return words[i][j / 64] >> (j % 64) & 1; }
+		void set(size_t i, size_t j) { words[i][j / 64] |= bit(j); }
+		void reset(size_t i, size_t j) { words[i][j / 64] &= ~bit(j); }
+
+		/* packed words of row i, for copying whole rows */
+		uint64_t* row(size_t i) { return words[i]; }
+		size_t row_bytes() const { return words.cols() * sizeof(uint64_t); }
+
+		/* for threads writing different bits of the same word */
+		void set_atomic(size_t i, size_t j) {
+			std::atomic_ref<uint64_t>(words[i][j / 64]).fetch_or(bit(j), std::memory_order_relaxed);
+		}
+		void reset_atomic(size_t i, size_t j) {
+			std::atomic_ref<uint64_t>(words[i][j / 64]).fetch_and(~bit(j), std::memory_order_relaxed);
+		}
+
+	private:
+		Grid<uint64_t> words;
+
+		static uint64_t bit(size_t j) { return uint64_t(1) << (j % 64); }
+};
+
+/* Single aligned allocation holding every field of the simulation.
+ * Fields are laid out in two passes: the first pass (before allocate())
+ * only measures the arena, the second one hands out the actual views. */
+class Arena {
+	public:
+		static constexpr size_t cache_line = 64;
+		static constexpr size_t page = 4096;
+		static constexpr size_t huge_page = 2 << 20;
+
+		Arena();
+		~Arena();
+		Arena(const Arena&) = delete;
+		Arena& operator=(const Arena&) = delete;
+
+		template<class T>
+		Grid<T> grid(size_t rows, size_t cols);
+		BitGrid bits(size_t rows, size_t cols) { return BitGrid(grid<uint64_t>(rows, (cols + 63) / 64)); }
+
+		void allocate();
+		char* data() { return base; }
+		size_t bytes() const { return capacity; }
+
+	private:
+		char* base;
+		size_t offset;
+		size_t capacity;
+
+		static size_t round_up(size_t n, size_t align) {
+			return (n + align - 1) / align * align;
+		}
+};
+
+template<class T>
+Grid<T> Arena::grid(size_t rows, size_t cols) {
+	static_assert(cache_line % sizeof(T) == 0, "field element must tile a cache line");
+
+	/* pad rows to whole cache lines, avoiding strides that alias in the cache */
+	size_t row_bytes = round_up(cols * sizeof(T), cache_line);
+	if(row_bytes % page == 0) {
+		row_bytes += cache_line;
+	}
+
+	T* ptr = base ? reinterpret_cast<T*>(base + offset) : nullptr;
+	offset += rows * row_bytes;
+
+	return Grid<T>(ptr, rows, cols, row_bytes / sizeof(T));
+}
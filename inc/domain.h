@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/* Communication of a distributed run. The lattice is cut into strips of
+ * whole rows, one per process, and the strips form a ring: the fields
+ * are periodic, so the first strip borders on the last one. The previous
+ * strip lies above, the next one below. Sim only calls these from the
+ * thread running the step, which is thread 0 of its pool. */
+class Domain {
+	public:
+		virtual ~Domain() = default;
+
+		virtual int rank() const = 0;
+		virtual int ranks() const = 0;
+
+		/* Sends the row_bytes at first to the previous strip and at last
+		 * to the next one, and receives what they send into above and below. */
+		virtual void exchange(const void* first, const void* last, void* above, void* below, size_t row_bytes) = 0;
+
+		/* Sends a message to either neighbour and receives theirs */
+		virtual void trade(const std::vector<char>& to_prev, const std::vector<char>& to_next,
+				std::vector<char>& from_prev, std::vector<char>& from_next) = 0;
+
+		/* element-wise reductions over all processes, in place */
+		virtual void max(float* v, size_t n) = 0;
+		virtual void min(uint64_t* v, size_t n) = 0;
+		virtual void sum(int64_t* v, size_t n) = 0;
+};
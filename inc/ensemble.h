@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <libconfig.h++>
+#include "sim.h"
+
+/* Runs many simulations of one configuration in a single process, for
+ * replicates and parameter sweeps. The configuration is parsed once,
+ * each run overrides the swept parameters and its seed, runs single
+ * threaded and keeps only its cell numbers. Runs are spread over a
+ * WorkPool whose size bounds both the number of live Sim instances and
+ * their memory. All time series go to one MAT file. */
+class Ensemble {
+	public:
+		explicit Ensemble(const char* config_file);
+
+		void run();
+
+	private:
+		/* One simulation of the sweep and its cell numbers per step */
+		struct Run {
+			size_t combination;
+			int replicate;
+			int seed;
+			int steps;
+			int stopped_by;
+			std::vector<int32_t> num_healthy;
+			std::vector<int32_t> num_tumor;
+			std::vector<int32_t> num_deadtumor;
+			std::vector<int32_t> num_immune;
+		};
+
+		std::unique_ptr<libconfig::Config> cfg;
+		std::vector<std::string> names;
+		std::vector<std::vector<double>> combinations;
+		std::vector<Run> runs;
+		int replicates;
+		size_t workers;
+		std::string file;
+
+		std::mutex mtx;
+		size_t finished;
+
+		Overrides overrides(const Run& run) const;
+		void execute(Run& run);
+		void write();
+};
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* Raw snapshot file: a fixed header with the run parameters, an index
+ * with the step of every frame and then frames of fixed stride. Header
+ * and index are memory mapped, frames are written with pwrite. n_frames
+ * is only advanced once a frame and its index entry are complete, so
+ * readers may open the file while the simulation is still writing.
+ * A frame holds rows rows of the size x size lattice from row0 on, all
+ * of them unless a distributed run writes one file per strip. */
+namespace frame_file {
+	constexpr char magic[8] = {'C', 'A', 'S', 'I', 'M', 'F', 'R', '1'};
+	constexpr uint32_t version = 2;
+	constexpr size_t header_bytes = 4096;
+	constexpr size_t max_params = 96;
+
+	struct Param {
+		char name[24];
+		int32_t is_float;
+		union {
+			int32_t i;
+			float f;
+		};
+	};
+
+	struct Header {
+		char magic[8];
+		uint32_t version;
+		uint32_t size;
+		uint32_t rows;
+		uint32_t row0;
+		uint64_t frame_bytes;
+		uint64_t index_offset;
+		uint64_t data_offset;
+		uint64_t capacity;
+		uint64_t n_frames;
+		uint32_t n_params;
+		uint32_t reserved;
+		Param params[max_params];
+	};
+	static_assert(sizeof(Header) <= header_bytes, "frame header exceeds its page");
+
+	/* Byte offsets of the layers within a frame. cells and immune hold
+	 * the 8 bit cell codes, the fields are float. */
+	struct Layout {
+		size_t cells;
+		size_t immune;
+		size_t nutrient;
+		size_t attr;
+		size_t ecm_stress;
+		size_t bytes;
+
+		Layout(size_t rows, size_t cols);
+	};
+}
+
+class FrameWriter {
+	public:
+		/* A run resuming at first_step > 0 continues an existing file, the
+		 * frames of steps from first_step on are dropped from it. */
+		FrameWriter(const std::string& path, size_t size, size_t rows, size_t row0, size_t capacity, uint64_t first_step = 0);
+		~FrameWriter();
+		FrameWriter(const FrameWriter&) = delete;
+		FrameWriter& operator=(const FrameWriter&) = delete;
+
+		void add_param(const char* name, int value);
+		void add_param(const char* name, float value);
+
+		void write(uint64_t step, const int32_t* cells, const int32_t* immune,
+				const float* nutrient, const float* attr, const float* ecm_stress);
+
+	private:
+		int fd;
+		size_t map_bytes;
+		frame_file::Header* header;
+		uint64_t* index;
+		frame_file::Layout layout;
+		std::vector<char> frame;
+
+		frame_file::Param& next_param(const char* name);
+		void map(const std::string& path, size_t bytes);
+		void resume(const std::string& path, size_t size, size_t rows, size_t row0, uint64_t first_step);
+};
+
+class FrameReader {
+	public:
+		explicit FrameReader(const std::string& path);
+		~FrameReader();
+		FrameReader(const FrameReader&) = delete;
+		FrameReader& operator=(const FrameReader&) = delete;
+
+		const frame_file::Header& info() const { return *header; }
+		size_t frames() const;
+		uint64_t step(size_t k) const { return index[k]; }
+
+		const uint8_t* cells(size_t k) const { return frame(k) + layout.cells; }
+		const uint8_t* immune(size_t k) const { return frame(k) + layout.immune; }
+		const float* nutrient(size_t k) const { return reinterpret_cast<const float*>(frame(k) + layout.nutrient); }
+		const float* attr(size_t k) const { return reinterpret_cast<const float*>(frame(k) + layout.attr); }
+		const float* ecm_stress(size_t k) const { return reinterpret_cast<const float*>(frame(k) + layout.ecm_stress); }
+
+	private:
+		int fd;
+		size_t map_bytes;
+		const char* base;
+		const frame_file::Header* header;
+		const uint64_t* index;
+		frame_file::Layout layout;
+
+		const uint8_t* frame(size_t k) const {
+			return reinterpret_cast<const uint8_t*>(base + header->data_offset + k * header->frame_bytes);
+		}
+};
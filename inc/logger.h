@@ -1,8 +1,20 @@
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "frame_file.h"
 #include "matio.h"
 #include "sim.h"
 
+/* Writes the simulation output on a background thread. The step loop
+ * only copies the fields into a free snapshot buffer and queues it, all
+ * matio calls happen on the writer thread. */
 class Logger {
 	public:
 		Logger(Sim& sim);
@@ -12,6 +24,36 @@ class Logger {
 		void log_mat();
 
 	private:
+		/* Dense copy of the lattice layers for one output frame */
+		struct Snapshot {
+			std::vector<int32_t> cells;
+			std::vector<int32_t> immune;
+			std::vector<float> nutrient;
+			std::vector<float> attr;
+			std::vector<float> ecm_stress;
+		};
+
+		/* Cell numbers and solver statistics of one step */
+		struct Record {
+			int num_healthy;
+			int num_tumor;
+			int num_deadtumor;
+			int num_immune;
+			int nutr_iter;
+			float nutr_res;
+		};
+
+		struct Job {
+			bool mat;
+			size_t buf;
+			uint64_t step;
+			Record rec;
+		};
+
+		Sim& sim;
+		size_t rows;
+		bool lead;
+		std::unique_ptr<FrameWriter> frames;
 		mat_t* mat_file;
 		mat_t* num_file;
 		matvar_t* cells_var;
@@ -23,7 +65,51 @@ class Logger {
 		matvar_t* num_tumor_var;
 		matvar_t* num_deadtumor_var;
 		matvar_t* num_immune_var;
+		matvar_t* nutr_iter_var;
+		matvar_t* nutr_res_var;
+		matvar_t* quant_scale_var;
+		matvar_t* quant_offset_var;
+
+		/* Output encoding, applied on the writer thread */
+		matio_compression cells_comp;
+		matio_compression immune_comp;
+		matio_compression nutrient_comp;
+		matio_compression attr_comp;
+		matio_compression ecm_comp;
+		int quantize_bits;
+		bool delta;
+		std::vector<int32_t> prev_cells;
+		std::vector<int32_t> prev_immune;
+		std::vector<int8_t> delta_buf;
+		std::vector<uint8_t> quant8;
+		std::vector<uint16_t> quant16;
+		float quant_scale[3];
+		float quant_offset[3];
+
+		/* Writer thread */
+		bool drop_full;
+		std::vector<Snapshot> snapshots;
+		std::vector<size_t> free_bufs;
+		std::deque<Job> jobs;
+		Record rec;
+		size_t dropped;
+		/* set once a raw frame could not be written, later ones are skipped */
+		std::atomic<bool> frames_failed;
+		bool stop;
+		std::mutex mtx;
+		std::condition_variable cv_job;
+		std::condition_variable cv_free;
+		std::thread writer;
 
+		mat_t* resume_num(uint64_t steps);
 		void saveParam(int* var, const char* name);
 		void saveParam(float* var, const char* name);
+		void copy(Snapshot& snap);
+		void push(const Job& job);
+		void write_loop();
+		void write_mat(Snapshot& snap, uint64_t step);
+		void write_num(const Record& r);
+		void write_cells(matvar_t* var, const std::vector<int32_t>& cur, std::vector<int32_t>& prev, matio_compression comp);
+		void write_field(matvar_t* var, std::vector<float>& data, size_t k, matio_compression comp);
+		matio_compression compression(const char* name);
 };
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <mpi.h>
+#include "domain.h"
+
+/* Domain over an MPI communicator, rank k holds the k-th strip */
+class MpiDomain : public Domain {
+	public:
+		explicit MpiDomain(MPI_Comm comm);
+
+		int rank() const override { return me; }
+		int ranks() const override { return n; }
+
+		void exchange(const void* first, const void* last, void* above, void* below, size_t row_bytes) override;
+		void trade(const std::vector<char>& to_prev, const std::vector<char>& to_next,
+				std::vector<char>& from_prev, std::vector<char>& from_next) override;
+
+		void max(float* v, size_t count) override;
+		void min(uint64_t* v, size_t count) override;
+		void sum(int64_t* v, size_t count) override;
+
+	private:
+		MPI_Comm comm;
+		int me;
+		int n;
+		int prev;
+		int next;
+};
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "arena.h"
+
+/* Geometric multigrid for the steady state of the nutrient field,
+ * -lap(u) + a*u = 0 on a periodic lattice. Cells with fixed != 0 keep
+ * their value (Dirichlet), which is how blood vessels enter the problem. */
+class Multigrid {
+	public:
+		enum class Cycle { V, F };
+
+		Multigrid();
+
+		void map_fields(Arena& arena, size_t size);
+		void solve(Grid<float>& u, const Grid<float>& absorb, const Grid<uint8_t>& fixed);
+
+		/* Settings */
+		Cycle cycle;
+		int max_cycles;
+		int smooth_steps;
+		int coarse_steps;
+		float tol;
+
+		/* Statistics of the last solve */
+		int cycles;
+		float residual;
+
+	private:
+		struct Level {
+			size_t n;
+			float h2;
+			Grid<float> u;
+			Grid<float> f;
+			Grid<float> r;
+			Grid<float> a;
+			Grid<uint8_t> fixed;
+		};
+
+		std::vector<Level> levels;
+
+		void build_coarse();
+		void run_cycle(size_t l, Cycle type);
+		void smooth(Level& lv);
+		float compute_residual(Level& lv);
+		void restrict_residual(const Level& fine, Level& coarse);
+		void prolongate(const Level& coarse, Level& fine);
+};
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+
+/* Neighbourhoods of a lattice cell as compile-time policies. A policy
+ * lists the offsets of the neighbours in row-major order, which is the
+ * order the rules pick from, and the weights of the Laplacian of the
+ * diffusion step on the same neighbours:
+ *
+ *   scale * (edge * (up + down + left + right) + corners - centre * r)
+ *
+ * with the corners up-left, up-right, down-left and down-right taken
+ * where corner[k] is set. The rules and the diffusion kernels are
+ * instantiated once per policy, so the loops over the neighbours unroll
+ * and the weights of 1 drop out. Every neighbour lies within one cell of
+ * the centre.
+ *
+ * spread is the Gershgorin bound of the negated Laplacian, mode the
+ * factor of sin^2 in the eigenvalue of the slowest sine mode of a square
+ * held at its border, 0 where those modes are no eigenvectors. Variants
+ * are drawn in vis/images/diffusion_neighbourhoods. */
+
+/* 4 neighbours sharing an edge, 5-point Laplacian */
+struct VonNeumann {
+	static constexpr int size = 4;
+	static constexpr int offsets[size][2] = {{-1, 0}, {0, -1}, {0, 1}, {1, 0}};
+	static constexpr float edge = 1.0f;
+	static constexpr bool corner[4] = {false, false, false, false};
+	static constexpr float centre = 4.0f;
+	static constexpr float scale = 1.0f;
+	static constexpr float spread = 8.0f;
+	static constexpr float mode = 8.0f;
+};
+
+/* Hexagonal lattice in axial coordinates: the 6 neighbours are the edge
+ * neighbours and one pair of opposite corners, so on the square picture
+ * the lattice appears sheared along that diagonal (ext_6.png). */
+struct Hexagonal {
+	static constexpr int size = 6;
+	static constexpr int offsets[size][2] = {{-1, -1}, {-1, 0}, {0, -1}, {0, 1}, {1, 0}, {1, 1}};
+	static constexpr float edge = 1.0f;
+	static constexpr bool corner[4] = {true, false, false, true};
+	static constexpr float centre = 6.0f;
+	static constexpr float scale = 2.0f / 3.0f;
+	static constexpr float spread = 8.0f;
+	static constexpr float mode = 0.0f;
+};
+
+/* 8 neighbours sharing an edge or a corner, isotropic 9-point Laplacian.
+ * Its slowest mode decays a little slower than 8 sin^2, which keeps the
+ * Chebyshev bound on the safe side. */
+struct Moore {
+	static constexpr int size = 8;
+	static constexpr int offsets[size][2] = {{-1, -1}, {-1, 0}, {-1, 1}, {0, -1}, {0, 1}, {1, -1}, {1, 0}, {1, 1}};
+	static constexpr float edge = 4.0f;
+	static constexpr bool corner[4] = {true, true, true, true};
+	static constexpr float centre = 20.0f;
+	static constexpr float scale = 1.0f / 6.0f;
+	static constexpr float spread = 20.0f / 3.0f;
+	static constexpr float mode = 8.0f;
+};
+
+/* Laplacian of policy N at column j of the rows above (up), at (mid) and
+ * below (down) the centre */
+template<class N>
+inline float laplacian(const float* up, const float* mid, const float* down, size_t j) {
+	float right = mid[j+1];
+	float left = mid[j-1];
+	float below = down[j];
+	float above = up[j];
+	float sum = above + below + left + right;
+
+	if constexpr(N::edge != 1.0f) {
+		sum = N::edge * sum;
+	}
+	if constexpr(N::corner[0]) {
+		sum += up[j-1];
+	}
+	if constexpr(N::corner[1]) {
+		sum += up[j+1];
+	}
+	if constexpr(N::corner[2]) {
+		sum += down[j-1];
+	}
+	if constexpr(N::corner[3]) {
+		sum += down[j+1];
+	}
+	sum -= N::centre * mid[j];
+
+	if constexpr(N::scale != 1.0f) {
+		sum = N::scale * sum;
+	}
+	return sum;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+/* Independent random streams of the simulation. Each one gets its own
+ * counter space so draws of different phases never coincide. */
+enum class Purpose : uint32_t {
+	InitTumor	= 1,
+	InitVessel	= 2,
+	InitImmune	= 3,
+	Ecm			= 4,
+	MoveOrder	= 5,
+	Move		= 6,
+	ProlifOrder	= 7,
+	Prolif		= 8,
+	Recruit		= 9
+};
+
+/* Counter-based generator (Philox4x32-10, Salmon et al. 2011). A draw is
+ * a pure function of the seed and the counter (step, cell, purpose, k),
+ * so random numbers do not depend on the order cells are visited in and
+ * any phase can be split across threads without changing the result. */
+class Rng {
+	public:
+		using Block = std::array<uint32_t, 4>;
+
+		explicit Rng(uint64_t seed = 0) :
+			key{static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32)} {}
+
+		/* four independent 32 bit words */
+		Block operator()(uint64_t step, uint64_t cell, Purpose purpose, uint32_t k = 0) const {
+			Block ctr = {static_cast<uint32_t>(step), static_cast<uint32_t>(cell),
+				static_cast<uint32_t>(purpose) | static_cast<uint32_t>(cell >> 32) << 8, k};
+			uint32_t k0 = key[0];
+			uint32_t k1 = key[1];
+
+			for(int r = 0; r < 10; ++r) {
+				uint64_t p0 = static_cast<uint64_t>(M0) * ctr[0];
+				uint64_t p1 = static_cast<uint64_t>(M1) * ctr[2];
+				ctr = {static_cast<uint32_t>(p1 >> 32) ^ ctr[1] ^ k0, static_cast<uint32_t>(p1),
+					static_cast<uint32_t>(p0 >> 32) ^ ctr[3] ^ k1, static_cast<uint32_t>(p0)};
+				k0 += W0;
+				k1 += W1;
+			}
+
+			return ctr;
+		}
+
+		/* uniform in [0, 1) */
+		static float uniform(uint32_t x) {
+			return static_cast<float>(x >> 8) * 0x1p-24f;
+		}
+
+		/* uniform in [lo, hi] */
+		static int uniform_int(uint32_t x, int lo, int hi) {
+			uint64_t range = static_cast<uint64_t>(static_cast<int64_t>(hi) - lo + 1);
+			return lo + static_cast<int>(range * x >> 32);
+		}
+
+	private:
+		static constexpr uint32_t M0 = 0xD2511F53;
+		static constexpr uint32_t M1 = 0xCD9E8D57;
+		static constexpr uint32_t W0 = 0x9E3779B9;
+		static constexpr uint32_t W1 = 0xBB67AE85;
+
+		std::array<uint32_t, 2> key;
+};
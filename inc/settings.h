@@ -0,0 +1,18 @@
+#pragma once
+
+#include <iostream>
+#include <libconfig.h++>
+
+/* reads a required setting and reports the name of a missing or mistyped one */
+template<class T>
+void read_setting(const libconfig::Setting& setting, const char* name, T& var) {
+	try {
+		var = T(setting.lookup(name));
+	} catch(const libconfig::SettingNotFoundException &snfex) {
+		std::cerr << "Setting '" << name << "' not found in configuration file." << std::endl;
+		throw;
+	} catch(const libconfig::SettingTypeException &stex) {
+		std::cerr << "Wrong type in setting '" << name << "'." << std::endl;
+		throw;
+	}
+}
@@ -5,12 +5,27 @@
 #include <cstring>
 #include <string>
 #include <random>
-#include <chrono>
 #include <vector>
+#include <memory>
 #include <algorithm>
+#include <atomic>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
 #include <libconfig.h++>
+#include "active_set.h"
+#include "arena.h"
+#include "domain.h"
+#include "multigrid.h"
+#include "neighbourhood.h"
+#include "rng.h"
+#include "stencil.h"
+#include "thread_pool.h"
+#include "trace.h"
 
-enum class Cell : int { 
+enum class Cell : uint8_t { 
 	Empty		= 0,
 	Healthy		= 10, 
 	Tumor		= 20,
@@ -19,6 +34,9 @@ enum class Cell : int {
 	Immune		= 50
 };
 
+/* numeric parameters replacing the values of the configuration file */
+using Overrides = std::map<std::string, double>;
+
 struct Coord {
 	size_t x;
 	size_t y;
@@ -26,39 +44,71 @@ struct Coord {
 
 class Sim {
 	public:
-		Sim(char* config_file);
+		explicit Sim(const char* config_file);
+		Sim(const libconfig::Config& cfg, const Overrides& overrides = Overrides(), Domain* domain = nullptr);
 		~Sim();
 
+		static std::unique_ptr<libconfig::Config> load_config(const char* config_file);
+
+		void run_step();
+
 		void diffuse();
 		void damage_ecm();
 		void move_immune();
 		void kill_tumor();
 		void kill_immune();
 		void kill_healthy();
+		void update_cells();
 		void proliferate();
 		void recruit_immune();
 		void count_cells();
 		bool tumor_killed();
+		void next_step();
+		void checkpoint();
+		uint64_t current_step() const { return step; }
+		size_t memory() const { return arena.bytes(); }
+		size_t tumor_margin() const;
 
 		int n_steps;
 		int log_step;
 		bool log_mat;
 
 	private:
-		static constexpr size_t size = 200;
-		static constexpr int nbrhood = 8;
+		size_t size;
+		Overrides overrides;
+
+		/* Strip of a distributed run: rows holds the owned rows and a halo
+		 * row on either side mirroring the neighbouring strips, row0 is the
+		 * global row of the first owned one. A single process owns all rows
+		 * without halo. Positions and lists use local rows, the RNG and the
+		 * visiting order global ones, so both do not depend on the split. */
+		Domain* domain;
+		size_t rows;
+		size_t halo;
+		size_t row0;
 		
 		/* Matrices */
-		Cell cells[size][size];
-		Cell immune[size][size];
-		int prolif_cnt[size][size];
-		int kill_cnt[size][size];
-		int life_cnt[size][size];
-		float nutrient[size][size];
-		float attr[size][size];
-		float ecm_stress[size][size];
-
-		float temp_float[size][size];
+		Arena arena;
+		Grid<Cell> cells;
+		BitGrid immune;
+		Grid<int16_t> prolif_cnt;
+		Grid<int16_t> kill_cnt;
+		Grid<int16_t> life_cnt;
+		Grid<float> nutrient;
+		Grid<float> attr;
+		Grid<float> ecm_stress;
+
+		/* the solved fields, on the cell lattice unless coarsened */
+		Grid<float> field_nutr;
+		Grid<float> field_attr;
+		Grid<float> temp_nutr;
+		Grid<float> temp_attr;
+		Grid<float> absorb;
+		Grid<uint8_t> fixed;
+		Grid<float> source;
+		Grid<uint8_t> attr_fixed;
+		Grid<uint64_t> claim;
+		Grid<uint64_t> vacated;
 		
 		/* Parameters */
 		float sim_time;
@@ -78,33 +128,251 @@ class Sim {
 		int life_steps;
 		bool vessels_on_borders;
 		float vessel_num;
+		float tumor_radius;
 		const float diff_dt = 0.2;
 
-		/* Neighbourhood*/
-		static constexpr int nbr[][2] = {{-1, -1}, {-1, 0}, {-1, 1}, {0, -1}, {0, 1}, {1, -1}, {1, 0}, {1, 1}};
+		/* Nutrient solver */
+		bool use_multigrid;
+		Multigrid mg;
+		int nutr_iter;
+		float nutr_res;
+		int attr_iter;
+		float attr_res;
+		bool nutr_capped;
+		bool attr_capped;
+		static constexpr int max_sweeps = 100000;
+
+		/* Parallel execution */
+		int threads;
+		size_t tile_size;
+		std::unique_ptr<ThreadPool> pool;
+		std::string simd;
+		Stencil kernels;
+
+		/* Coarse chemical fields: each field cell spans coarsen x coarsen
+		 * cells, interpolation weights are shared by rows and columns */
+		struct Interp {
+			uint32_t lo;
+			uint32_t hi;
+			float w;
+		};
+		size_t coarsen;
+		size_t field_size;
+		size_t field_rows;
+		std::vector<Interp> interp;
+
+		/* Incremental re-solve */
+		bool incremental;
+		size_t dirty_pad;
+		float dirty_tol;
+		int full_solve_every;
+		int diff_step;
+		size_t tile_rows;
+		size_t tile_cols;
+		std::vector<uint8_t> dirty;
+		std::vector<uint8_t> act_nutr;
+		std::vector<uint8_t> act_attr;
+		std::vector<size_t> active;
+
+		/* Pseudo-time iteration */
+		bool chebyshev;
+		bool relative_tol;
+		/* the Laplacian rounds to a cycle of one float step of the field,
+		 * a change within that step ends the iteration */
+		bool float_floor;
+		float nutr_tol;
+		float attr_tol;
+		/* upper end of the nutrient sweep spectrum measured by the last
+		 * solve, 0 until its probe sweeps have run */
+		float nutr_bound;
+
+		/* Extrapolation of one sweep, track asks for the largest value */
+		struct Accel {
+			bool on;
+			bool track;
+			float omega;
+			float gamma;
+		};
+
+		/* Temporal blocking */
+		struct Scratch {
+			std::vector<float> u[2];
+			std::vector<float> coef;
+			std::vector<uint8_t> fix;
+			std::vector<float> prev;
+		};
+		size_t time_block;
+		std::vector<Scratch> scratch;
+
+		/* Immune migration */
+		struct Mover {
+			size_t i;
+			size_t j;
+			size_t x;
+			size_t y;
+			uint64_t key;
+			bool claimed;
+			bool done;
+		};
+		std::string move_mode;
+		bool parallel_move;
+
+		/* Active sets */
+		ActiveSet tumor_set;
+		ActiveSet border_set;
+		ActiveSet stressed_set;
+		ActiveSet immune_set;
+		std::vector<Coord> vessels;
+		size_t total_vessels;
+
+		/* Vessel layouts shared between runs, see vessels.cpp */
+		std::string vessel_load_file;
+		std::string vessel_save_file;
+
+		/* Rules that walk the neighbourhood of a cell, compiled for each
+		 * policy of neighbourhood.h and picked at startup */
+		struct Rules {
+			void (Sim::*damage_ecm)();
+			void (Sim::*proliferate)();
+			void (Sim::*update_border)(size_t i, size_t j);
+		};
+		int neighbourhood;
+		int diff_neighbourhood;
+		Rules rules;
+		template<class N>
+		static Rules rules_for();
+		template<class N>
+		void damage_ecm_on();
+		template<class N>
+		void proliferate_on();
+		template<class N>
+		void update_border_on(size_t i, size_t j);
 		
 		/* Cell numbers */
 		int num_healthy;
 		int num_tumor;
 		int num_deadtumor;
 		int num_immune;
+		int synced[4];
+		size_t window_i0;
+		size_t window_i1;
+		size_t window_j0;
+		size_t window_j1;
+		bool check_counts;
+
+		/* num_tumor after every step so far, for the stop conditions */
+		std::vector<int> tumor_history;
 
 		/* Random numbers */
-		std::default_random_engine gen;
+		int seed;
+		Rng rng;
+		uint64_t step;
+
+		/* Instrumentation, set while a Trace is attached */
+		Trace* trace = nullptr;
+
+		/* Checkpoints */
+		int checkpoint_every;
+		bool checkpoint_async;
+		std::string checkpoint_file;
+		std::string restart_file;
+		std::vector<char> ckpt_buf;
+		std::thread ckpt_thread;
 
 		/* Functions */
 		template<class T>
 		void read_param(const libconfig::Setting& setting, const char* name, T& var);
+		void map_fields();
+		void update_coefficients(size_t i0, size_t i1, size_t j0, size_t j1, float& d_nutr, float& d_attr);
+		void tile_bounds(size_t t, size_t& i0, size_t& i1, size_t& j0, size_t& j1);
+		size_t tile_of(size_t i, size_t j) const {
+			return (i - halo) / coarsen / tile_size * tile_cols + j / coarsen / tile_size;
+		}
+		void mark_dirty(size_t i, size_t j) {
+			dirty[tile_of(i, j)] = 1;
+		}
+		std::vector<uint8_t> fresh_tiles();
+		void prolongate(size_t t);
+		void sync_fields(bool all);
+		void select_tiles(const std::vector<uint8_t>& seed, bool full, std::vector<uint8_t>& tiles);
+
+		size_t global_row(size_t i) const { return row0 + i - halo; }
+		size_t local_row(size_t g) const { return g - row0 + halo; }
+		bool owned(size_t i) const { return i - halo < rows - 2*halo; }
+		uint64_t global_pos(size_t i, size_t j) const { return global_row(i) * size + j; }
 
+		/* Hand-offs between strips, see halo.cpp */
+		struct Stress {
+			uint64_t pos;
+			float value;
+		};
+		struct Emigrant {
+			uint64_t from;
+			uint64_t to;
+			uint64_t key;
+			int16_t kill_cnt;
+			int16_t life_cnt;
+		};
+		struct Daughter {
+			uint64_t from;
+			uint64_t to;
+			uint64_t key;
+			int16_t prolif_cnt;
+			int16_t parent_cnt;
+		};
+		template<class T>
+		void swap_halo(Grid<T>& g);
+		void swap_halo(BitGrid& g);
+		void send_stress(const std::vector<Stress>& out, const std::vector<Stress>& first_row);
+		void send_immune(const std::vector<Emigrant>& out);
+		void send_daughters(const std::vector<Daughter>& out);
+		void sync_strips();
+		void reduce_counts();
+
+		void update_border(size_t i, size_t j) { (this->*rules.update_border)(i, j); }
 		void healthy_die(size_t i, size_t j);
+		void update_cell(size_t i, size_t j);
 		void tumor_apoptosis(size_t i, size_t j);
 		void tumor_necrosis(size_t i, size_t j);
 		void immune_die(size_t i, size_t j);
-		void diffuse_nutr(size_t i, size_t j, float& max_diff);
-		void diffuse_nutr(size_t i, size_t j, size_t i_m, size_t i_p, size_t j_m, size_t j_p, float& max_diff);
-		void diffuse_attr(size_t i, size_t j, float& max_diff);
+
+		/* tumor cells are only counted inside the configured window */
+		bool in_window(size_t i, size_t j) const {
+			size_t g = global_row(i);
+			return g >= window_i0 && g < window_i1 && j >= window_j0 && j < window_j1;
+		}
+		void tally(Cell cell, bool imm, size_t i, size_t j);
+		void check_counters();
+		uint64_t order_key(size_t i, size_t j, Purpose purpose);
+		void shuffle(std::vector<Coord>& cells_list, Purpose purpose);
+		void immune_target(size_t i, size_t j, size_t& x, size_t& y);
+		void move_immune_parallel();
+		void diffuse_nutr(const Grid<float>& in, Grid<float>& out, size_t i, size_t j, size_t i_m, size_t i_p, size_t j_m, size_t j_p, float& max_diff);
+		void sweep_nutr(const Grid<float>& in, Grid<float>& out, size_t i0, size_t i1, size_t j0, size_t j1, float& max_diff,
+				const Accel& acc, float* prev, float& max_val);
+		void diffuse_attr(const Grid<float>& in, Grid<float>& out, size_t i, size_t j, size_t i_m, size_t i_p, size_t j_m, size_t j_p, float& max_diff);
+		void sweep_attr(const Grid<float>& in, Grid<float>& out, size_t i0, size_t i1, size_t j0, size_t j1, float& max_diff,
+				const Accel& acc, float* prev, float& max_val);
+		void block_tile(size_t t, const Grid<float>* in_n, Grid<float>* out_n, const Grid<float>* in_a, Grid<float>* out_a,
+				float& d_nutr, float& d_attr, float& u_nutr, float& u_attr, Scratch& sc);
+		void relax(bool solve_nutr);
+		void restore(const std::string& path);
+		std::vector<uint64_t> load_vessels(const std::string& path);
+		void save_vessels(const std::string& path);
+		void timed(Trace::Phase phase, void (Sim::*rule)());
 
 		friend class Logger;
+		friend class Ensemble;
+		friend class Termination;
+		friend class Trace;
+		friend class Bench;
 		std::string mat_file;
+		std::string raw_file;
+		std::string output_format;
+		int snapshot_buffers;
+		std::string snapshot_policy;
+		std::vector<std::string> compress_fields;
+		int quantize_bits;
+		bool delta_cells;
 		std::string num_file;
 };
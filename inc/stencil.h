@@ -0,0 +1,59 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "neighbourhood.h"
+
+/* Row kernels of the explicit diffusion step, vectorised for the widest
+ * instruction set the CPU offers and compiled for the Laplacian of each
+ * neighbourhood. A kernel updates out[j] for j in [0, n) from the rows
+ * above (up), at (mid) and below (down) the current one, so element -1
+ * and n of these must be readable. It returns the largest change. */
+struct Stencil {
+	using NutrRow = float (*)(float* out, const float* up, const float* mid, const float* down,
+			const float* absorb, const uint8_t* fixed, size_t n, float dt);
+	using AttrRow = float (*)(float* out, const float* up, const float* mid, const float* down,
+			const float* source, const uint8_t* fixed, size_t n, float dt);
+
+	/* Chebyshev extrapolation of a row: out holds the plain update of the
+	 * current iterate cur, prev the iterate before it. Returns the largest
+	 * new value. */
+	using Extrapolate = float (*)(float* out, const float* cur, const float* prev, size_t n, float omega, float gamma);
+	using RowMax = float (*)(const float* u, size_t n);
+
+	/* single cell at column 1 of three-cell rows, for the periodic edge */
+	using Cell = float (*)(const float* up, const float* mid, const float* down, float coef, float dt);
+
+	NutrRow nutr_row;
+	AttrRow attr_row;
+	Extrapolate extrapolate;
+	RowMax row_max;
+	const char* isa;
+	Cell nutr_cell;
+	Cell attr_cell;
+
+	/* neighbourhood of the Laplacian and its spectral bounds, see neighbourhood.h */
+	int neighbours;
+	float spread;
+	float mode;
+
+	/* isa is one of "auto", "avx512", "avx2" or "scalar", neighbours 4, 6 or 8 */
+	static Stencil select(const std::string& isa, int neighbours);
+
+	/* RK4 step of du/dt = lap(u) - A*u with the Laplacian frozen over the stages */
+	static inline float nutr_step(float nabla2, float r, float A, float dt) {
+		float k1 = nabla2 - A*r;
+		float k2 = nabla2 - A*(r + dt*k1/2);
+		float k3 = nabla2 - A*(r + dt*k2/2);
+		float k4 = nabla2 - A*(r + dt*k3);
+
+		return std::max(r + 1.0f/6.0f * dt * (k1 + 2*k2 + 2*k3 + k4), 0.0f);
+	}
+
+	/* Euler step of du/dt = lap(u) + S */
+	static inline float attr_step(float nabla2, float r, float S, float dt) {
+		return std::max(r + dt * (nabla2 + S), 0.0f);
+	}
+};
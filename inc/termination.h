@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <libconfig.h++>
+#include "sim.h"
+
+/* What the stop conditions see after a step. tumor_history holds
+ * num_tumor of every step so far, the current one last. */
+struct Observation {
+	uint64_t step;
+	float step_hours;
+	int num_healthy;
+	int num_tumor;
+	int num_deadtumor;
+	int num_immune;
+	size_t tumor_margin;
+	const std::vector<int>* tumor_history;
+};
+
+class StopCondition {
+	public:
+		virtual ~StopCondition() = default;
+
+		/* true once the run has settled */
+		virtual bool stop(const Observation& obs) const = 0;
+
+		/* tumor_margin is only computed if a condition asks for it */
+		virtual bool needs_margin() const { return false; }
+};
+
+using ConditionFactory = std::function<std::unique_ptr<StopCondition>(const libconfig::Setting&)>;
+
+/* Ends a run early once any of the conditions of the termination list
+ * holds. Conditions are looked up by their type name, add_type makes
+ * further types available to the configuration. */
+class Termination {
+	public:
+		Termination(const libconfig::Config& cfg, const Sim& sim);
+
+		static void add_type(const std::string& type, ConditionFactory factory);
+
+		/* observe the step just computed, true if the run should end */
+		bool update(const Sim& sim);
+
+		/* position of the condition that ended the run in the list, -1 while running */
+		int stopped_by() const { return which; }
+		const std::string& reason() const { return reasons[which]; }
+
+	private:
+		std::vector<std::unique_ptr<StopCondition>> conditions;
+		std::vector<std::string> reasons;
+		bool margin;
+		int which;
+
+		static std::map<std::string, ConditionFactory>& types();
+};
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <barrier>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* Fixed set of worker threads running fork-join regions.
+ * The calling thread takes part in every region as thread 0. */
+class ThreadPool {
+	public:
+		explicit ThreadPool(size_t n_threads);
+		~ThreadPool();
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		size_t size() const { return n_threads; }
+
+		/* run fn(tid) on every thread and wait for all of them */
+		void run(const std::function<void(size_t)>& fn);
+
+		/* synchronise all threads of the current region */
+		void barrier();
+
+	private:
+		size_t n_threads;
+		std::vector<std::thread> workers;
+		std::barrier<> sync;
+
+		std::mutex mtx;
+		std::condition_variable cv_start;
+		std::condition_variable cv_done;
+		const std::function<void(size_t)>* job;
+		size_t generation;
+		size_t pending;
+		bool stop;
+
+		void worker(size_t tid);
+};
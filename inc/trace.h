@@ -0,0 +1,85 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <libconfig.h++>
+
+class Sim;
+
+/* Per-step instrumentation: wall time of every phase and the solver
+ * statistics, written as CSV or as binary records, and a summary at the
+ * end of the run. With an empty trace_file nothing is attached to the
+ * Sim and no clock is ever read. */
+class Trace {
+	public:
+		enum Phase {
+			DamageEcm,
+			Diffuse,
+			MoveImmune,
+			RecruitImmune,
+			UpdateCells,
+			Proliferate,
+			Log,
+			n_phases
+		};
+
+		using Clock = std::chrono::steady_clock;
+
+		/* Binary record of one step in native layout, after the 8 byte magic "CASIMTR1" */
+		struct Record {
+			uint64_t step;
+			float seconds[n_phases];
+			int32_t nutr_iter;
+			float nutr_res;
+			int32_t attr_iter;
+			float attr_res;
+			uint8_t nutr_capped;
+			uint8_t attr_capped;
+		};
+
+		Trace(const libconfig::Config& cfg, Sim& sim);
+		~Trace();
+		Trace(const Trace&) = delete;
+		Trace& operator=(const Trace&) = delete;
+
+		bool enabled() const { return on; }
+
+		Clock::time_point start() const { return on ? Clock::now() : Clock::time_point(); }
+
+		void stop(Phase phase, Clock::time_point t0) {
+			if(on) {
+				add(phase, Clock::now() - t0);
+			}
+		}
+
+		void add(Phase phase, Clock::duration d) {
+			rec.seconds[phase] += std::chrono::duration<float>(d).count();
+		}
+
+		/* write the record of the finished step and start the next one */
+		void end_step();
+
+		static const char* name(Phase phase);
+
+	private:
+		Sim& sim;
+		bool on;
+		bool binary;
+		std::ofstream out;
+		Record rec;
+
+		/* summary */
+		uint64_t steps;
+		double total[n_phases];
+		float worst[n_phases];
+		int64_t nutr_iter;
+		int64_t attr_iter;
+		int max_nutr_iter;
+		int max_attr_iter;
+		uint64_t nutr_capped;
+		uint64_t attr_capped;
+
+		void summary();
+};
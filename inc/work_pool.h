@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/* Runs independent tasks on a fixed number of threads. Each thread owns
+ * a deque of task indices and takes work from its back; once it runs dry
+ * it steals from the front of the other deques. Tasks of very different
+ * length, like simulations that end early, thus keep all threads busy. */
+class WorkPool {
+	public:
+		explicit WorkPool(size_t n_threads);
+		WorkPool(const WorkPool&) = delete;
+		WorkPool& operator=(const WorkPool&) = delete;
+
+		size_t size() const { return n_threads; }
+
+		/* run fn(task, tid) for every task in [0, n_tasks) and wait for all of them */
+		void run(size_t n_tasks, const std::function<void(size_t, size_t)>& fn);
+
+	private:
+		struct Queue {
+			std::mutex mtx;
+			std::deque<size_t> tasks;
+		};
+
+		size_t n_threads;
+		std::vector<std::unique_ptr<Queue>> queues;
+
+		bool take(size_t tid, size_t& task);
+		void worker(size_t tid, const std::function<void(size_t, size_t)>& fn, std::exception_ptr& error);
+};
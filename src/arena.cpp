@@ -0,0 +1,30 @@
+#include <cstdlib>
+#include <new>
+#include <sys/mman.h>
+#include "arena.h"
+
+Arena::Arena() : base(nullptr), offset(0), capacity(0) {}
+
+Arena::~Arena() {
+	std::free(base);
+}
+
+void Arena::allocate() {
+	/* large arenas are aligned to huge pages so the kernel can back them with THP */
+	size_t align = offset >= huge_page ? huge_page : page;
+	capacity = round_up(offset, align);
+
+	base = static_cast<char*>(std::aligned_alloc(align, capacity));
+	if(base == nullptr) {
+		throw std::bad_alloc();
+	}
+
+#ifdef MADV_HUGEPAGE
+	if(align == huge_page) {
+		madvise(base, capacity, MADV_HUGEPAGE);
+	}
+#endif
+
+	std::memset(base, 0, capacity);
+	offset = 0;
+}
@@ -0,0 +1,275 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "logger.h"
+#include "settings.h"
+#include "sim.h"
+
+/* Benchmarks of the simulation on synthetic states. Every state is built
+ * from the configuration with a fixed seed and one of the bench lists
+ * varied around the first entries of the others. Each rule of a step is
+ * timed on its own, full steps are timed without logging, with the cell
+ * numbers and with a MAT frame every step. Results are written as JSON. */
+class Bench {
+	public:
+		explicit Bench(const char* config_file);
+
+		void run();
+
+	private:
+		using Clock = std::chrono::steady_clock;
+
+		struct State {
+			int size;
+			float tumor_fraction;
+			float vessel_num;
+			float immune_ratio;
+		};
+
+		std::unique_ptr<libconfig::Config> cfg;
+		std::string config_file;
+		std::string file;
+		int seed;
+		int warmup;
+		int steps;
+		int end_to_end_steps;
+		std::vector<State> states;
+		std::ostringstream json;
+
+		Overrides overrides(const State& state) const;
+		void phases(const State& state, bool last);
+		void end_to_end(const State& state, const char* logging, bool last);
+		static void stats(std::ostream& out, std::vector<double>& us);
+};
+
+namespace {
+	template<class T>
+	std::vector<T> read_list(const libconfig::Setting& setting, const char* name) {
+		std::vector<T> v;
+		try {
+			const libconfig::Setting& list = setting[name];
+			for(int k = 0; k < list.getLength(); ++k) {
+				v.push_back(T(list[k]));
+			}
+		} catch(const libconfig::SettingNotFoundException &snfex) {
+			std::cerr << "Setting '" << name << "' not found in the bench group." << std::endl;
+			throw;
+		} catch(const libconfig::SettingTypeException &stex) {
+			std::cerr << "Wrong type in setting '" << name << "'." << std::endl;
+			throw;
+		}
+		if(v.empty()) {
+			std::cerr << "Setting '" << name << "' needs at least one value." << std::endl;
+			throw std::invalid_argument(name);
+		}
+		return v;
+	}
+}
+
+Bench::Bench(const char* config_file) : cfg(Sim::load_config(config_file)), config_file(config_file) {
+	const libconfig::Setting& bench = cfg->getRoot()["bench"];
+
+	read_setting<int>(bench, "seed", seed);
+	read_setting<int>(bench, "warmup", warmup);
+	read_setting<int>(bench, "steps", steps);
+	read_setting<int>(bench, "end_to_end_steps", end_to_end_steps);
+	read_setting<std::string>(bench, "file", file);
+	std::vector<int> sizes = read_list<int>(bench, "sizes");
+	std::vector<float> tumor_fractions = read_list<float>(bench, "tumor_fractions");
+	std::vector<float> vessel_nums = read_list<float>(bench, "vessel_nums");
+	std::vector<float> immune_ratios = read_list<float>(bench, "immune_ratios");
+
+	if(seed < 0 || warmup < 0 || steps < 1 || end_to_end_steps < 1) {
+		std::cerr << "The bench needs a fixed seed and positive step counts." << std::endl;
+		throw std::invalid_argument("bench");
+	}
+
+	/* the base state and one list varied at a time */
+	State base = {sizes[0], tumor_fractions[0], vessel_nums[0], immune_ratios[0]};
+	states.push_back(base);
+	for(size_t k = 1; k < sizes.size(); ++k) {
+		states.push_back(base);
+		states.back().size = sizes[k];
+	}
+	for(size_t k = 1; k < tumor_fractions.size(); ++k) {
+		states.push_back(base);
+		states.back().tumor_fraction = tumor_fractions[k];
+	}
+	for(size_t k = 1; k < vessel_nums.size(); ++k) {
+		states.push_back(base);
+		states.back().vessel_num = vessel_nums[k];
+	}
+	for(size_t k = 1; k < immune_ratios.size(); ++k) {
+		states.push_back(base);
+		states.back().immune_ratio = immune_ratios[k];
+	}
+}
+
+/* the tumor disc covers the requested share of the lattice */
+Overrides Bench::overrides(const State& state) const {
+	Overrides o;
+	o["size"] = state.size;
+	o["tumor_radius"] = std::sqrt(state.tumor_fraction * state.size * state.size / static_cast<float>(M_PI));
+	o["vessel_num"] = state.vessel_num;
+	o["init_immune_ratio"] = state.immune_ratio;
+	o["seed"] = seed;
+	o["checkpoint_every"] = 0;
+	o["sim_time"] = 1e6;
+	return o;
+}
+
+void Bench::run() {
+	json << "{\n";
+	json << "\t\"benchmark\": \"ca_sim_bench\",\n";
+	json << "\t\"config\": \"" << config_file << "\",\n";
+	json << "\t\"seed\": " << seed << ",\n";
+	json << "\t\"warmup\": " << warmup << ",\n";
+	json << "\t\"steps\": " << steps << ",\n";
+
+	{
+		Sim sim(*cfg, overrides(states[0]));
+		json << "\t\"threads\": " << sim.threads << ",\n";
+		json << "\t\"simd\": \"" << sim.simd << "\",\n";
+		json << "\t\"diff_solver\": \"" << (sim.use_multigrid ? "multigrid" : "rk4") << "\",\n";
+		json << "\t\"time_block\": " << sim.time_block << ",\n";
+	}
+
+	json << "\t\"phases\": [\n";
+	for(size_t k = 0; k < states.size(); ++k) {
+		phases(states[k], k + 1 == states.size());
+	}
+	json << "\t],\n";
+
+	json << "\t\"end_to_end\": [\n";
+	end_to_end(states[0], "none", false);
+	end_to_end(states[0], "num", false);
+	end_to_end(states[0], "mat", true);
+	json << "\t]\n";
+	json << "}\n";
+
+	std::ofstream out(file, std::ios::trunc);
+	out << json.str();
+	if(!out) {
+		std::cerr << "Cannot write '" << file << "'." << std::endl;
+		throw std::runtime_error("bench");
+	}
+	std::cout << "results written to " << file << std::endl;
+}
+
+/* time every rule separately, in the order of a step, after the fields have settled */
+void Bench::phases(const State& state, bool last) {
+	Sim sim(*cfg, overrides(state));
+	for(int n = 0; n < warmup; ++n) {
+		sim.run_step();
+		sim.next_step();
+	}
+
+	static const char* names[] = {"damage_ecm", "diffuse", "move_immune", "recruit_immune", "update_cells", "proliferate"};
+	void (Sim::*rules[])() = {&Sim::damage_ecm, &Sim::diffuse, &Sim::move_immune, &Sim::recruit_immune, &Sim::update_cells, &Sim::proliferate};
+	std::vector<std::vector<double>> us(6);
+
+	/* whole lattice, num_tumor only counts the configured window */
+	size_t num_tumor = sim.tumor_set.size();
+	size_t num_immune = sim.immune_set.size();
+	for(int n = 0; n < steps; ++n) {
+		for(int p = 0; p < 6; ++p) {
+			Clock::time_point t0 = Clock::now();
+			(sim.*rules[p])();
+			us[p].push_back(std::chrono::duration<double, std::micro>(Clock::now() - t0).count());
+		}
+		sim.next_step();
+	}
+
+	json << "\t\t{\n";
+	json << "\t\t\t\"size\": " << state.size << ", \"tumor_fraction\": " << state.tumor_fraction
+		<< ", \"vessel_num\": " << state.vessel_num << ", \"immune_ratio\": " << state.immune_ratio << ",\n";
+	json << "\t\t\t\"tumor_cells\": " << num_tumor << ", \"immune_cells\": " << num_immune
+		<< ", \"vessels\": " << sim.vessels.size() << ",\n";
+	for(int p = 0; p < 6; ++p) {
+		json << "\t\t\t\"" << names[p] << "\": ";
+		stats(json, us[p]);
+		json << (p < 5 ? ",\n" : "\n");
+	}
+	json << "\t\t}" << (last ? "\n" : ",\n");
+
+	std::cout << "size " << state.size << ", tumor " << state.tumor_fraction << ", vessels " << state.vessel_num
+		<< ", immune " << state.immune_ratio << ": diffuse " << us[1][us[1].size() / 2] << " us" << std::endl;
+}
+
+/* whole steps as ca_sim runs them, logging to a scratch directory */
+void Bench::end_to_end(const State& state, const char* logging, bool last) {
+	Overrides o = overrides(state);
+	o["log_step"] = 1;
+	o["log_mat"] = std::string(logging) == "mat";
+	Sim sim(*cfg, o);
+
+	std::filesystem::path dir = std::filesystem::temp_directory_path();
+	sim.mat_file = (dir / "ca_sim_bench_mat.mat").string();
+	sim.num_file = (dir / "ca_sim_bench_num.mat").string();
+	sim.output_format = "mat";
+
+	for(int n = 0; n < warmup; ++n) {
+		sim.run_step();
+		sim.next_step();
+	}
+
+	double seconds;
+	{
+		std::unique_ptr<Logger> logger;
+		if(std::string(logging) != "none") {
+			logger = std::make_unique<Logger>(sim);
+		}
+
+		/* the Logger drains its queue when destroyed, which belongs to the timing */
+		Clock::time_point t0 = Clock::now();
+		for(int n = 0; n < end_to_end_steps; ++n) {
+			sim.run_step();
+			if(logger) {
+				logger->log_num();
+				if(sim.log_mat) {
+					logger->log_mat();
+				}
+			}
+			sim.next_step();
+		}
+		logger.reset();
+		seconds = std::chrono::duration<double>(Clock::now() - t0).count();
+	}
+	std::filesystem::remove(sim.mat_file);
+	std::filesystem::remove(sim.num_file);
+
+	json << "\t\t{ \"size\": " << state.size << ", \"logging\": \"" << logging << "\", \"steps\": " << end_to_end_steps
+		<< ", \"seconds\": " << seconds << ", \"steps_per_second\": " << end_to_end_steps / seconds << " }"
+		<< (last ? "\n" : ",\n");
+
+	std::cout << "end to end, logging " << logging << ": " << end_to_end_steps / seconds << " steps/s" << std::endl;
+}
+
+void Bench::stats(std::ostream& out, std::vector<double>& us) {
+	std::sort(us.begin(), us.end());
+	double sum = 0.0;
+	for(double t : us) {
+		sum += t;
+	}
+	out << "{ \"min_us\": " << us.front() << ", \"median_us\": " << us[us.size() / 2]
+		<< ", \"mean_us\": " << sum / us.size() << ", \"max_us\": " << us.back() << " }";
+}
+
+int main(int argc, char** argv)
+{
+	if(argc > 2) {
+		std::cerr << "usage: " << argv[0] << " [config.cfg]" << std::endl;
+		return 1;
+	}
+
+	Bench bench(argc == 2 ? argv[1] : "../config.cfg");
+	bench.run();
+
+	return 0;
+}
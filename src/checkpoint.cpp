@@ -0,0 +1,212 @@
+#include <cstdio>
+#include <fstream>
+#include "sim.h"
+
+/* Checkpoint layout: a fixed header, the whole arena in one block and
+ * the state kept outside of it (step, counters, active set lists). The
+ * RNG is counter based, seed and step are its complete state. */
+namespace {
+	constexpr char ckpt_magic[8] = {'C', 'A', 'S', 'I', 'M', 'C', 'K', '3'};
+
+	struct CheckpointHeader {
+		char magic[8];
+		uint64_t size;
+		uint64_t arena_bytes;
+		uint64_t tail_bytes;
+	};
+
+	template<class T>
+	void put(std::vector<char>& buf, const T& v) {
+		const char* p = reinterpret_cast<const char*>(&v);
+		buf.insert(buf.end(), p, p + sizeof(T));
+	}
+
+	template<class T>
+	void put(std::vector<char>& buf, const std::vector<T>& v) {
+		put(buf, static_cast<uint64_t>(v.size()));
+		const char* p = reinterpret_cast<const char*>(v.data());
+		buf.insert(buf.end(), p, p + v.size() * sizeof(T));
+	}
+
+	class Tail {
+		public:
+			Tail(const char* data, size_t bytes) : p(data), end(data + bytes) {}
+
+			template<class T>
+			void get(T& v) {
+				take(&v, sizeof(T));
+			}
+
+			template<class T>
+			void get(std::vector<T>& v) {
+				uint64_t n;
+				get(n);
+				if(n > static_cast<uint64_t>(end - p) / sizeof(T)) {
+					truncated();
+				}
+				v.resize(n);
+				take(v.data(), n * sizeof(T));
+			}
+
+		private:
+			const char* p;
+			const char* end;
+
+			void take(void* dst, size_t n) {
+				if(n > static_cast<size_t>(end - p)) {
+					truncated();
+				}
+				std::memcpy(dst, p, n);
+				p += n;
+			}
+
+			[[noreturn]] static void truncated() {
+				std::cerr << "Checkpoint is truncated." << std::endl;
+				throw std::runtime_error("checkpoint");
+			}
+	};
+}
+
+/* The step is serialized on the simulation thread, writing it to disk
+ * may run in the background while the next steps are computed. */
+void Sim::checkpoint() {
+	if(ckpt_thread.joinable()) {
+		ckpt_thread.join();
+	}
+
+	std::vector<char> tail;
+	put(tail, step);
+	put(tail, seed);
+	put(tail, diff_step);
+	put(tail, num_healthy);
+	put(tail, num_tumor);
+	put(tail, num_deadtumor);
+	put(tail, num_immune);
+	put(tail, nutr_iter);
+	put(tail, nutr_res);
+	put(tail, attr_iter);
+	put(tail, attr_res);
+	put(tail, nutr_bound);
+	put(tail, static_cast<uint8_t>(field_nutr.data() > temp_nutr.data()));
+	put(tail, static_cast<uint8_t>(field_attr.data() > temp_attr.data()));
+	put(tail, dirty);
+	put(tail, tumor_set.items());
+	put(tail, border_set.items());
+	put(tail, stressed_set.items());
+	put(tail, immune_set.items());
+	put(tail, vessels);
+	put(tail, tumor_history);
+
+	CheckpointHeader header;
+	std::memcpy(header.magic, ckpt_magic, sizeof(ckpt_magic));
+	header.size = size;
+	header.arena_bytes = arena.bytes();
+	header.tail_bytes = tail.size();
+
+	/* one contiguous image of the state */
+	ckpt_buf.resize(sizeof(header) + arena.bytes() + tail.size());
+	std::memcpy(ckpt_buf.data(), &header, sizeof(header));
+	std::memcpy(ckpt_buf.data() + sizeof(header), arena.data(), arena.bytes());
+	std::memcpy(ckpt_buf.data() + sizeof(header) + arena.bytes(), tail.data(), tail.size());
+
+	auto write = [this]() {
+		/* a crash while writing leaves the previous checkpoint intact */
+		std::string tmp = checkpoint_file + ".tmp";
+		std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+		out.write(ckpt_buf.data(), static_cast<std::streamsize>(ckpt_buf.size()));
+		out.close();
+
+		if(!out || std::rename(tmp.c_str(), checkpoint_file.c_str()) != 0) {
+			std::cerr << "Writing checkpoint '" << checkpoint_file << "' failed." << std::endl;
+		}
+	};
+
+	if(checkpoint_async) {
+		ckpt_thread = std::thread(write);
+	} else {
+		write();
+	}
+}
+
+void Sim::restore(const std::string& path) {
+	std::ifstream in(path, std::ios::binary | std::ios::ate);
+	if(!in) {
+		std::cerr << "Cannot open checkpoint '" << path << "'." << std::endl;
+		throw std::runtime_error("checkpoint");
+	}
+
+	std::vector<char> buf(static_cast<size_t>(in.tellg()));
+	in.seekg(0);
+	in.read(buf.data(), static_cast<std::streamsize>(buf.size()));
+
+	CheckpointHeader header;
+	if(buf.size() < sizeof(header)) {
+		std::cerr << "Checkpoint is truncated." << std::endl;
+		throw std::runtime_error("checkpoint");
+	}
+	std::memcpy(&header, buf.data(), sizeof(header));
+
+	if(std::memcmp(header.magic, ckpt_magic, sizeof(ckpt_magic)) != 0) {
+		std::cerr << "'" << path << "' is not a checkpoint." << std::endl;
+		throw std::runtime_error("checkpoint");
+	}
+	/* the arena layout follows from size and the configured solvers */
+	if(header.size != size || header.arena_bytes != arena.bytes()) {
+		std::cerr << "Checkpoint was written with a different size or solver configuration." << std::endl;
+		throw std::runtime_error("checkpoint");
+	}
+	if(buf.size() != sizeof(header) + header.arena_bytes + header.tail_bytes) {
+		std::cerr << "Checkpoint is truncated." << std::endl;
+		throw std::runtime_error("checkpoint");
+	}
+
+	std::memcpy(arena.data(), buf.data() + sizeof(header), arena.bytes());
+
+	Tail tail(buf.data() + sizeof(header) + arena.bytes(), header.tail_bytes);
+	uint8_t nutr_swapped, attr_swapped;
+	std::vector<uint32_t> items;
+
+	tail.get(step);
+	tail.get(seed);
+	tail.get(diff_step);
+	tail.get(num_healthy);
+	tail.get(num_tumor);
+	tail.get(num_deadtumor);
+	tail.get(num_immune);
+	tail.get(nutr_iter);
+	tail.get(nutr_res);
+	tail.get(attr_iter);
+	tail.get(attr_res);
+	tail.get(nutr_bound);
+	tail.get(nutr_swapped);
+	tail.get(attr_swapped);
+	tail.get(dirty);
+	tail.get(items);
+	tumor_set.assign(items);
+	tail.get(items);
+	border_set.assign(items);
+	tail.get(items);
+	stressed_set.assign(items);
+	tail.get(items);
+	immune_set.assign(items);
+	tail.get(vessels);
+	tail.get(tumor_history);
+
+	/* the solvers leave the latest iterate in either buffer */
+	if(nutr_swapped) {
+		field_nutr.swap(temp_nutr);
+	}
+	if(attr_swapped) {
+		field_attr.swap(temp_attr);
+	}
+	sync_fields(true);
+	synced[0] = num_healthy;
+	synced[1] = num_tumor;
+	synced[2] = num_deadtumor;
+	synced[3] = num_immune;
+
+	rng = Rng(seed);
+	if(!domain || domain->rank() == 0) {
+		std::cout << "restarted from step " << step << std::endl;
+	}
+}
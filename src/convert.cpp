@@ -0,0 +1,107 @@
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include "frame_file.h"
+#include "matio.h"
+
+/* Converts a raw frame file into the MAT layout the Logger writes, with
+ * the run parameters and the cells, immune, nutrient, attr and
+ * ecm_stress layers stacked along the third dimension. The files of the
+ * strips of a distributed run are joined into whole frames. */
+int main(int argc, char** argv)
+{
+	if(argc < 3) {
+		std::cerr << "usage: " << argv[0] << " <frames.raw>... <data_mat.mat>" << std::endl;
+		return 1;
+	}
+	const char* out = argv[argc - 1];
+
+	std::vector<std::unique_ptr<FrameReader>> strips;
+	for(int k = 1; k < argc - 1; ++k) {
+		strips.push_back(std::make_unique<FrameReader>(argv[k]));
+	}
+	std::sort(strips.begin(), strips.end(), [](auto const& a, auto const& b) { return a->info().row0 < b->info().row0; });
+
+	/* the strips have to cover the lattice row by row */
+	const frame_file::Header& info = strips[0]->info();
+	size_t size = info.size;
+	size_t n = size * size;
+	size_t n_frames = strips[0]->frames();
+	size_t next_row = 0;
+	for(auto const& s : strips) {
+		if(s->info().size != size || s->info().row0 != next_row) {
+			std::cerr << "The frame files do not cover a " << size << "x" << size << " lattice." << std::endl;
+			return 1;
+		}
+		next_row += s->info().rows;
+		n_frames = std::min(n_frames, s->frames());
+	}
+	if(next_row != size) {
+		std::cerr << "The frame files do not cover a " << size << "x" << size << " lattice." << std::endl;
+		return 1;
+	}
+
+	mat_t* mat_file = Mat_CreateVer(out, NULL, MAT_FT_MAT73);
+	if(mat_file == NULL) {
+		std::cerr << "Cannot create '" << out << "'." << std::endl;
+		return 1;
+	}
+
+	size_t dims_1[2] = {1, 1};
+	for(uint32_t k = 0; k < info.n_params; ++k) {
+		const frame_file::Param& p = info.params[k];
+		int32_t i = p.i;
+		float f = p.f;
+		matvar_t* var = p.is_float ?
+			Mat_VarCreate(p.name, MAT_C_SINGLE, MAT_T_SINGLE, 2, dims_1, &f, 0) :
+			Mat_VarCreate(p.name, MAT_C_INT32, MAT_T_INT32, 2, dims_1, &i, 0);
+		Mat_VarWrite(mat_file, var, MAT_COMPRESSION_NONE);
+		Mat_VarFree(var);
+	}
+
+	std::vector<int32_t> cells(n);
+	std::vector<int32_t> immune(n);
+	std::vector<float> nutrient(n);
+	std::vector<float> attr(n);
+	std::vector<float> ecm_stress(n);
+	size_t dims_m[3] = {size, size, 1};
+	matvar_t* cells_var = Mat_VarCreate("cells", MAT_C_INT32, MAT_T_INT32, 3, dims_m, cells.data(), MAT_F_DONT_COPY_DATA);
+	matvar_t* immune_var = Mat_VarCreate("immune", MAT_C_INT32, MAT_T_INT32, 3, dims_m, immune.data(), MAT_F_DONT_COPY_DATA);
+	matvar_t* nutrient_var = Mat_VarCreate("nutrient", MAT_C_SINGLE, MAT_T_SINGLE, 3, dims_m, nutrient.data(), MAT_F_DONT_COPY_DATA);
+	matvar_t* attr_var = Mat_VarCreate("attr", MAT_C_SINGLE, MAT_T_SINGLE, 3, dims_m, attr.data(), MAT_F_DONT_COPY_DATA);
+	matvar_t* ecm_var = Mat_VarCreate("ecm_stress", MAT_C_SINGLE, MAT_T_SINGLE, 3, dims_m, ecm_stress.data(), MAT_F_DONT_COPY_DATA);
+
+	for(size_t k = 0; k < n_frames; ++k) {
+		for(auto const& s : strips) {
+			size_t c0 = s->info().row0 * size;
+			size_t m = s->info().rows * size;
+
+			for(size_t c = 0; c < m; ++c) {
+				cells[c0 + c] = s->cells(k)[c];
+				immune[c0 + c] = s->immune(k)[c];
+			}
+			std::memcpy(nutrient.data() + c0, s->nutrient(k), m * sizeof(float));
+			std::memcpy(attr.data() + c0, s->attr(k), m * sizeof(float));
+			std::memcpy(ecm_stress.data() + c0, s->ecm_stress(k), m * sizeof(float));
+		}
+
+		Mat_VarWriteAppend(mat_file, cells_var, MAT_COMPRESSION_ZLIB, 3);
+		Mat_VarWriteAppend(mat_file, immune_var, MAT_COMPRESSION_ZLIB, 3);
+		Mat_VarWriteAppend(mat_file, nutrient_var, MAT_COMPRESSION_ZLIB, 3);
+		Mat_VarWriteAppend(mat_file, attr_var, MAT_COMPRESSION_ZLIB, 3);
+		Mat_VarWriteAppend(mat_file, ecm_var, MAT_COMPRESSION_ZLIB, 3);
+	}
+
+	Mat_VarFree(cells_var);
+	Mat_VarFree(immune_var);
+	Mat_VarFree(nutrient_var);
+	Mat_VarFree(attr_var);
+	Mat_VarFree(ecm_var);
+	Mat_Close(mat_file);
+
+	std::cout << n_frames << " frames of " << size << "x" << size << " converted." << std::endl;
+
+	return 0;
+}
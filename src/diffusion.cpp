@@ -0,0 +1,670 @@
+#include "sim.h"
+
+/* Copies an h x w window starting at global cell (gi, gj) of a periodic
+ * field into a dense scratch array. */
+template<class T>
+static void gather(const Grid<T>& g, T* dst, size_t gi, size_t gj, size_t h, size_t w, size_t size) {
+	for(size_t r = 0; r < h; ++r) {
+		const T* row = g[(gi + r) % size];
+		T* d = dst + r * w;
+
+		for(size_t k = 0, j = gj; k < w; j = 0) {
+			size_t run = std::min(w - k, size - j);
+			std::memcpy(d + k, row + j, run * sizeof(T));
+			k += run;
+		}
+	}
+}
+
+/* A cell at the periodic edge: its 3 x 3 block is gathered so the
+ * Laplacian of the neighbourhood can take it like an interior cell */
+inline void Sim::diffuse_nutr(const Grid<float>& in, Grid<float>& out, size_t i, size_t j, size_t i_m, size_t i_p, size_t j_m, size_t j_p, float& max_diff) {
+	float up[3] = {in[i_m][j_m], in[i_m][j], in[i_m][j_p]};
+	float mid[3] = {in[i][j_m], in[i][j], in[i][j_p]};
+	float down[3] = {in[i_p][j_m], in[i_p][j], in[i_p][j_p]};
+
+	float v = kernels.nutr_cell(up, mid, down, absorb[i][j], diff_dt);
+	out[i][j] = fixed[i][j] ? in[i][j] : v;
+
+	float diff = std::abs(out[i][j] - in[i][j]);
+	if(diff > max_diff) {
+		max_diff = diff;
+	}
+}
+
+inline void Sim::diffuse_attr(const Grid<float>& in, Grid<float>& out, size_t i, size_t j, size_t i_m, size_t i_p, size_t j_m, size_t j_p, float& max_diff) {
+	float up[3] = {in[i_m][j_m], in[i_m][j], in[i_m][j_p]};
+	float mid[3] = {in[i][j_m], in[i][j], in[i][j_p]};
+	float down[3] = {in[i_p][j_m], in[i_p][j], in[i_p][j_p]};
+
+	float v = kernels.attr_cell(up, mid, down, source[i][j], diff_dt);
+	out[i][j] = attr_fixed[i][j] ? in[i][j] : v;
+
+	float diff = std::abs(out[i][j] - in[i][j]);
+	if(diff > max_diff) {
+		max_diff = diff;
+	}
+}
+
+void Sim::sweep_nutr(const Grid<float>& in, Grid<float>& out, size_t i0, size_t i1, size_t j0, size_t j1, float& max_diff,
+		const Accel& acc, float* prev, float& max_val) {
+	/* interior columns go through the vector kernel */
+	size_t js = std::max<size_t>(j0, 1);
+	size_t je = std::min(j1, field_size-1);
+
+	for(size_t i = i0; i < i1; ++i) {
+		/* periodic boundary conditions */
+		size_t i_m = i == 0 ? field_rows-1 : i-1;
+		size_t i_p = i == field_rows-1 ? 0 : i+1;
+
+		if(acc.on) {
+			std::memcpy(prev, out[i] + j0, (j1 - j0) * sizeof(float));
+		}
+
+		if(j0 == 0) {
+			diffuse_nutr(in, out, i, 0, i_m, i_p, field_size-1, 1, max_diff);
+		}
+		if(js < je) {
+			float diff = kernels.nutr_row(out[i] + js, in[i_m] + js, in[i] + js, in[i_p] + js, absorb[i] + js, fixed[i] + js, je - js, diff_dt);
+			max_diff = std::max(max_diff, diff);
+		}
+		if(j1 == field_size) {
+			diffuse_nutr(in, out, i, field_size-1, i_m, i_p, field_size-2, 0, max_diff);
+		}
+
+		if(acc.on) {
+			max_val = std::max(max_val, kernels.extrapolate(out[i] + j0, in[i] + j0, prev, j1 - j0, acc.omega, acc.gamma));
+		} else if(acc.track) {
+			max_val = std::max(max_val, kernels.row_max(out[i] + j0, j1 - j0));
+		}
+	}
+}
+
+void Sim::sweep_attr(const Grid<float>& in, Grid<float>& out, size_t i0, size_t i1, size_t j0, size_t j1, float& max_diff,
+		const Accel& acc, float* prev, float& max_val) {
+	size_t js = std::max<size_t>(j0, 1);
+	size_t je = std::min(j1, field_size-1);
+
+	for(size_t i = i0; i < i1; ++i) {
+		size_t i_m = i == 0 ? field_rows-1 : i-1;
+		size_t i_p = i == field_rows-1 ? 0 : i+1;
+
+		if(acc.on) {
+			std::memcpy(prev, out[i] + j0, (j1 - j0) * sizeof(float));
+		}
+
+		if(j0 == 0) {
+			diffuse_attr(in, out, i, 0, i_m, i_p, field_size-1, 1, max_diff);
+		}
+		if(js < je) {
+			float diff = kernels.attr_row(out[i] + js, in[i_m] + js, in[i] + js, in[i_p] + js, source[i] + js, attr_fixed[i] + js, je - js, diff_dt);
+			max_diff = std::max(max_diff, diff);
+		}
+		if(j1 == field_size) {
+			diffuse_attr(in, out, i, field_size-1, i_m, i_p, field_size-2, 0, max_diff);
+		}
+
+		if(acc.on) {
+			max_val = std::max(max_val, kernels.extrapolate(out[i] + j0, in[i] + j0, prev, j1 - j0, acc.omega, acc.gamma));
+		} else if(acc.track) {
+			max_val = std::max(max_val, kernels.row_max(out[i] + j0, j1 - j0));
+		}
+	}
+}
+
+/* Temporal blocking of one tile: the tile and a halo of time_block cells
+ * are gathered into thread-local scratch and advanced time_block
+ * pseudo-time steps while they are in cache. The valid region shrinks by
+ * one cell per step, so after the last one exactly the tile is up to date
+ * and written back. Halo cells are recomputed by the neighbouring tiles. */
+void Sim::block_tile(size_t t, const Grid<float>* in_n, Grid<float>* out_n, const Grid<float>* in_a, Grid<float>* out_a,
+		float& d_nutr, float& d_attr, float& u_nutr, float& u_attr, Scratch& sc) {
+	size_t i0, i1, j0, j1;
+	tile_bounds(t, i0, i1, j0, j1);
+
+	size_t T = time_block;
+	size_t H = i1 - i0 + 2*T;
+	size_t W = j1 - j0 + 2*T;
+	size_t gi = (i0 + field_size - T) % field_size;
+	size_t gj = (j0 + field_size - T) % field_size;
+
+	auto advance = [&](const Grid<float>& in, Grid<float>& out, const float* coef, const uint8_t* fix, Stencil::NutrRow row,
+			float& max_diff, float& max_val) {
+		float* buf[2] = {sc.u[0].data(), sc.u[1].data()};
+		gather(in, buf[0], gi, gj, H, W, field_size);
+
+		for(size_t s = 1; s <= T; ++s) {
+			const float* src = buf[(s-1) % 2];
+			float* dst = buf[s % 2];
+
+			for(size_t r = s; r < H-s; ++r) {
+				size_t k = r*W + s;
+				float diff = row(dst + k, src + k - W, src + k, src + k + W, coef + k, fix + k, W - 2*s, diff_dt);
+				if(s == T) {
+					max_diff = std::max(max_diff, diff);
+				}
+			}
+		}
+
+		for(size_t r = T; r < H-T; ++r) {
+			std::memcpy(out[i0 + r - T] + j0, buf[T % 2] + r*W + T, (j1 - j0) * sizeof(float));
+			if(relative_tol || float_floor) {
+				max_val = std::max(max_val, kernels.row_max(buf[T % 2] + r*W + T, j1 - j0));
+			}
+		}
+	};
+
+	if(in_n) {
+		gather(absorb, sc.coef.data(), gi, gj, H, W, field_size);
+		gather(fixed, sc.fix.data(), gi, gj, H, W, field_size);
+		advance(*in_n, *out_n, sc.coef.data(), sc.fix.data(), kernels.nutr_row, d_nutr, u_nutr);
+	}
+	if(in_a) {
+		gather(source, sc.coef.data(), gi, gj, H, W, field_size);
+		gather(attr_fixed, sc.fix.data(), gi, gj, H, W, field_size);
+		advance(*in_a, *out_a, sc.coef.data(), sc.fix.data(), kernels.attr_row, d_attr, u_attr);
+	}
+}
+
+namespace {
+	/* Chebyshev semi-iteration of a sweep whose spectrum lies in [a, b].
+	 * a follows from the Gershgorin bound of the stencil. b < 1 belongs to
+	 * the slowest mode and depends on geometry: where it is not known the
+	 * first probe sweeps stay plain and measure it from the decay of their
+	 * residual. An underestimate of b only slows the slowest modes down,
+	 * to be safe the measured gap 1 - b is still halved. Between steps the
+	 * slowest mode barely moves, so later solves start from the last b.
+	 * The extrapolation amplifies rounding, far above the resolution of
+	 * the field on large values. Once its residual stops falling plain
+	 * sweeps take over from the converged slow modes. A tolerance below
+	 * the resolution would still only be met once every cell is an exact
+	 * fixed point, so those sweeps end when they stop falling in turn. */
+	class Chebyshev {
+		public:
+			Chebyshev(bool on, float a, float b) : on(on), stuck(false), a(a), start(b > 0.0f ? 0 : probe), pass(0), since(0),
+				r_probe(0.0f), r_best(0.0f), b_used(0.0f), sigma(0.0f), gamma(1.0f), omega(1.0f) {
+				if(on && start == 0) {
+					bounds(b);
+				}
+			}
+
+			/* the next sweep is extrapolated with weights omega and gamma */
+			bool extrapolate() const { return on && pass >= start; }
+			float weight() const { return omega; }
+			float step() const { return gamma; }
+			/* the b in use, 0 while probing; after a stall it is no longer trusted */
+			float bound() const { return stuck ? 0.0f : b_used; }
+
+			/* plain sweeps after a stall have stopped falling */
+			bool settled(float res) {
+				if(!stuck) {
+					return false;
+				}
+				since = res < r_best ? 0 : since + 1;
+				r_best = std::min(res, r_best);
+				return since == settle;
+			}
+
+			/* Close to the tolerance, or once the residual has not
+			 * reached a new low for stall passes, the extrapolation only
+			 * amplifies rounding and the remaining sweeps are plain. */
+			void update(float res, float tol) {
+				++pass;
+				if(!on) {
+					return;
+				}
+				if(pass > start && res < 4 * tol) {
+					on = false;
+					return;
+				}
+				if(pass > start) {
+					since = res < r_best || pass == start + 1 ? 0 : since + 1;
+					r_best = since == 0 ? res : r_best;
+					if(since == stall) {
+						on = false;
+						stuck = true;
+						since = 0;
+						return;
+					}
+				}
+
+				if(pass < start) {
+					if(pass == probe / 2) {
+						r_probe = res;
+					}
+				} else if(pass == start && start > 0) {
+					float ratio = r_probe > 0.0f ? std::pow(res / r_probe, 2.0f / probe) : 0.0f;
+					bounds(1.0f - (1.0f - std::min(ratio, 1.0f - 1e-6f)) / 2);
+				} else if(pass == start + 1) {
+					omega = 1 / (1 - sigma * sigma / 2);
+				} else {
+					omega = 1 / (1 - sigma * sigma * omega / 4);
+				}
+			}
+
+		private:
+			static constexpr int probe = 32;
+			static constexpr int stall = 64;
+			static constexpr int settle = 256;
+			bool on;
+			bool stuck;
+			float a;
+			int start;
+			int pass;
+			int since;
+			float r_probe;
+			float r_best;
+			float b_used;
+			float sigma;
+			float gamma;
+			float omega;
+
+			void bounds(float b) {
+				b = std::max(b, a + 1e-6f);
+				b_used = b;
+				sigma = (b - a) / (2 - a - b);
+				gamma = 2 / (2 - a - b);
+				omega = 1.0f;
+			}
+	};
+}
+
+/* Fused Jacobi iteration of nutrient and attractant over the active tiles.
+ * Both fields are advanced in the same pass over a tile, each stops on
+ * its own once converged. Every thread works on its share of tiles, the
+ * convergence test reduces per-thread maxima and each field is swapped
+ * with its spare buffer instead of copied. Both buffers hold the same
+ * values between solves, so tiles outside the active set are never
+ * touched. With Chebyshev acceleration the spare buffer holds the
+ * iterate before the current one, which the extrapolation needs. */
+void Sim::relax(bool solve_nutr) {
+	size_t n_threads = pool->size();
+	size_t n_active = active.size();
+	size_t T = time_block;
+
+	bool run_nutr = solve_nutr && std::count(act_nutr.begin(), act_nutr.end(), 1) > 0;
+	bool run_attr = std::count(act_attr.begin(), act_attr.end(), 1) > 0;
+	if(solve_nutr) {
+		nutr_iter = 0;
+		nutr_res = 0.0f;
+		nutr_capped = false;
+	}
+	attr_iter = 0;
+	attr_res = 0.0f;
+	attr_capped = false;
+	if(!run_nutr && !run_attr) {
+		return;
+	}
+
+	/* lower ends of the sweep spectra, 1 - dt * (spread + largest absorption).
+	 * The attractant is held at the lattice border, its slowest mode is
+	 * the first sine mode of the square; active tiles only shrink it.
+	 * Where that mode is no eigenvector the probe sweeps measure it. */
+	float a_nutr = 1.0f - diff_dt * (kernels.spread + alpha2 * (2.0f + lambda));
+	float a_attr = 1.0f - diff_dt * kernels.spread;
+	float s_min = std::sin(static_cast<float>(M_PI) / (2 * (field_size - 1)));
+	float b_attr = kernels.mode > 0.0f ? 1.0f - diff_dt * kernels.mode * s_min * s_min : 0.0f;
+
+	/* double buffered so one barrier per pass suffices */
+	struct alignas(64) Partial {
+		float d_nutr;
+		float d_attr;
+		float u_nutr;
+		float u_attr;
+	};
+	std::vector<Partial> partial(2 * n_threads);
+	Partial global[2];
+	scratch.resize(n_threads);
+	bool odd_nutr = false;
+	bool odd_attr = false;
+
+	pool->run([&](size_t tid) {
+		Grid<float>* in_n = &field_nutr;
+		Grid<float>* out_n = &temp_nutr;
+		Grid<float>* in_a = &field_attr;
+		Grid<float>* out_a = &temp_attr;
+		size_t t0 = tid * n_active / n_threads;
+		size_t t1 = (tid + 1) * n_active / n_threads;
+		size_t i0, i1, j0, j1;
+		bool go_nutr = run_nutr;
+		bool go_attr = run_attr;
+		float max_nutr = 0.0f;
+		float max_attr = 0.0f;
+		int sweeps_nutr = 0;
+		int sweeps_attr = 0;
+		Chebyshev cheb_nutr(chebyshev, a_nutr, nutr_bound);
+		Chebyshev cheb_attr(chebyshev, a_attr, b_attr);
+		bool short_nutr = run_nutr;
+		bool short_attr = run_attr;
+
+		Scratch& sc = scratch[tid];
+		if(T > 1) {
+			size_t n = (tile_size + 2*T) * (tile_size + 2*T);
+			sc.u[0].resize(n);
+			sc.u[1].resize(n);
+			sc.coef.resize(n);
+			sc.fix.resize(n);
+		}
+		if(chebyshev) {
+			sc.prev.resize(tile_size);
+		}
+
+		for(size_t pass = 0; (go_nutr || go_attr) && pass * T < static_cast<size_t>(max_sweeps); ++pass) {
+			float d_nutr = 0.0f;
+			float d_attr = 0.0f;
+			float u_nutr = 0.0f;
+			float u_attr = 0.0f;
+			Accel acc_nutr = {cheb_nutr.extrapolate(), relative_tol || float_floor, cheb_nutr.weight(), cheb_nutr.step()};
+			Accel acc_attr = {cheb_attr.extrapolate(), relative_tol || float_floor, cheb_attr.weight(), cheb_attr.step()};
+
+			for(size_t k = t0; k < t1; ++k) {
+				size_t t = active[k];
+				bool n = go_nutr && act_nutr[t];
+				bool a = go_attr && act_attr[t];
+
+				if(T > 1) {
+					block_tile(t, n ? in_n : nullptr, out_n, a ? in_a : nullptr, out_a, d_nutr, d_attr, u_nutr, u_attr, sc);
+				} else {
+					tile_bounds(t, i0, i1, j0, j1);
+					if(n) {
+						sweep_nutr(*in_n, *out_n, i0, i1, j0, j1, d_nutr, acc_nutr, sc.prev.data(), u_nutr);
+					}
+					if(a) {
+						sweep_attr(*in_a, *out_a, i0, i1, j0, j1, d_attr, acc_attr, sc.prev.data(), u_attr);
+					}
+				}
+			}
+			partial[(pass % 2) * n_threads + tid] = {d_nutr, d_attr, u_nutr, u_attr};
+			pool->barrier();
+
+			/* every thread reaches the same verdict from the same partials */
+			float m_nutr = 0.0f;
+			float m_attr = 0.0f;
+			float s_nutr = 0.0f;
+			float s_attr = 0.0f;
+			for(size_t k = 0; k < n_threads; ++k) {
+				const Partial& p = partial[(pass % 2) * n_threads + k];
+				m_nutr = std::max(m_nutr, p.d_nutr);
+				m_attr = std::max(m_attr, p.d_attr);
+				s_nutr = std::max(s_nutr, p.u_nutr);
+				s_attr = std::max(s_attr, p.u_attr);
+			}
+
+			/* Distributed: the verdict covers all strips and the new
+			 * iterate takes the edge rows of the neighbours as its halo */
+			if(domain) {
+				if(tid == 0) {
+					float v[4] = {m_nutr, m_attr, s_nutr, s_attr};
+					domain->max(v, 4);
+					global[pass % 2] = {v[0], v[1], v[2], v[3]};
+					if(go_nutr) {
+						swap_halo(*out_n);
+					}
+					if(go_attr) {
+						swap_halo(*out_a);
+					}
+				}
+				pool->barrier();
+
+				const Partial& g = global[pass % 2];
+				m_nutr = g.d_nutr;
+				m_attr = g.d_attr;
+				s_nutr = g.u_nutr;
+				s_attr = g.u_attr;
+			}
+
+			/* the change of a plain sweep, absolute or relative to the largest
+			 * value, and with float_floor at least one float step of it */
+			if(go_nutr) {
+				std::swap(in_n, out_n);
+				sweeps_nutr += T;
+				max_nutr = m_nutr;
+				float tol = nutr_tol * (relative_tol ? s_nutr : 1.0f);
+				float ulp = float_floor ? s_nutr * std::numeric_limits<float>::epsilon() : 0.0f;
+				short_nutr = m_nutr > 0.0f && m_nutr >= tol && m_nutr > ulp;
+				go_nutr = short_nutr && !cheb_nutr.settled(m_nutr);
+				cheb_nutr.update(m_nutr, tol);
+			}
+			if(go_attr) {
+				std::swap(in_a, out_a);
+				sweeps_attr += T;
+				max_attr = m_attr;
+				float tol = attr_tol * (relative_tol ? s_attr : 1.0f);
+				float ulp = float_floor ? s_attr * std::numeric_limits<float>::epsilon() : 0.0f;
+				short_attr = m_attr > 0.0f && m_attr >= tol && m_attr > ulp;
+				go_attr = short_attr && !cheb_attr.settled(m_attr);
+				cheb_attr.update(m_attr, tol);
+			}
+		}
+
+		/* bring the other buffers up to date on this thread's tiles */
+		for(size_t k = t0; k < t1; ++k) {
+			size_t t = active[k];
+			tile_bounds(t, i0, i1, j0, j1);
+			for(size_t i = i0; i < i1; ++i) {
+				if(run_nutr && act_nutr[t]) {
+					std::memcpy((*out_n)[i] + j0, (*in_n)[i] + j0, (j1 - j0) * sizeof(float));
+				}
+				if(run_attr && act_attr[t]) {
+					std::memcpy((*out_a)[i] + j0, (*in_a)[i] + j0, (j1 - j0) * sizeof(float));
+				}
+			}
+		}
+
+		if(tid == 0) {
+			if(run_nutr) {
+				nutr_iter = sweeps_nutr;
+				nutr_res = max_nutr;
+				nutr_capped = short_nutr;
+				nutr_bound = cheb_nutr.bound();
+			}
+			attr_iter = sweeps_attr;
+			attr_res = max_attr;
+			attr_capped = short_attr;
+
+			/* sweeps that settled short of the tolerance */
+			static std::atomic<bool> warned(false);
+			bool settled = (run_nutr && short_nutr && !go_nutr) || (run_attr && short_attr && !go_attr);
+			if(settled && !warned.exchange(true)) {
+				std::cerr << "diff_accel chebyshev settled at a residual of " << (short_attr && !go_attr ? max_attr : max_nutr)
+					<< ", nutr_tol and attr_tol below the float resolution of the field are not reached." << std::endl;
+			}
+			odd_nutr = in_n != &field_nutr;
+			odd_attr = in_a != &field_attr;
+		}
+	});
+
+	/* the latest iterate lives in the spare buffer after an odd number of passes */
+	if(odd_nutr) {
+		field_nutr.swap(temp_nutr);
+	}
+	if(odd_attr) {
+		field_attr.swap(temp_attr);
+	}
+}
+
+void Sim::tile_bounds(size_t t, size_t& i0, size_t& i1, size_t& j0, size_t& j1) {
+	i0 = halo + t / tile_cols * tile_size;
+	j0 = t % tile_cols * tile_size;
+	i1 = std::min(i0 + tile_size, field_rows - halo);
+	j1 = std::min(j0 + tile_size, field_size);
+}
+
+/* Tiles to re-solve: all of them on a global step, otherwise the tiles
+ * whose coefficients changed since the last step grown by dirty_pad cells. */
+void Sim::select_tiles(const std::vector<uint8_t>& seed, bool full, std::vector<uint8_t>& tiles) {
+	size_t n_tiles = tile_rows * tile_cols;
+
+	if(full) {
+		tiles.assign(n_tiles, 1);
+		return;
+	}
+
+	size_t field_pad = (dirty_pad + coarsen - 1) / coarsen;
+	long pad = static_cast<long>(std::min((field_pad + tile_size - 1) / tile_size, std::min(tile_rows, tile_cols) / 2));
+	long n_rows = static_cast<long>(tile_rows);
+	long n_cols = static_cast<long>(tile_cols);
+	tiles.assign(n_tiles, 0);
+
+	for(long ti = 0; ti < n_rows; ++ti) {
+		for(long tj = 0; tj < n_cols; ++tj) {
+			if(!seed[ti * n_cols + tj]) {
+				continue;
+			}
+			for(long di = -pad; di <= pad; ++di) {
+				for(long dj = -pad; dj <= pad; ++dj) {
+					tiles[(ti + di + n_rows) % n_rows * n_cols + (tj + dj + n_cols) % n_cols] = 1;
+				}
+			}
+		}
+	}
+}
+
+/* Cell states do not change while the fields converge, so the
+ * coefficients of both equations are evaluated once per step. A field
+ * cell covers coarsen x coarsen cells: on that spacing the Laplacian
+ * shrinks by coarsen^2, which the unit stencil absorbs by summing the
+ * uptake and secretion of the block instead of averaging them. A field
+ * cell holding a vessel is pinned like the vessel itself. Returns the
+ * largest change of the nutrient and attractant coefficients. */
+void Sim::update_coefficients(size_t i0, size_t i1, size_t j0, size_t j1, float& d_nutr, float& d_attr) {
+	d_nutr = 0.0f;
+	d_attr = 0.0f;
+
+	for(size_t i = i0; i < i1; ++i) {
+		for(size_t j = j0; j < j1; ++j) {
+			float A = 0.0f;
+			uint8_t F = 0;
+			float S = 0.0f;
+
+			for(size_t x = i * coarsen; x < (i + 1) * coarsen; ++x) {
+				for(size_t y = j * coarsen; y < (j + 1) * coarsen; ++y) {
+					A += alpha2 * (static_cast<float>(cells[x][y] == Cell::Healthy) +
+									static_cast<float>(immune.test(x, y)) +
+									lambda * static_cast<float>(cells[x][y] == Cell::Tumor));
+					F |= cells[x][y] == Cell::Vessel;
+					S += beta2 * static_cast<float>(cells[x][y] == Cell::Tumor || cells[x][y] == Cell::DeadTumor);
+				}
+			}
+
+			d_nutr = std::max(d_nutr, std::abs(A - absorb[i][j]));
+			if(F != fixed[i][j]) {
+				d_nutr = std::numeric_limits<float>::infinity();
+			}
+			d_attr = std::max(d_attr, std::abs(S - source[i][j]));
+
+			absorb[i][j] = A;
+			fixed[i][j] = F;
+			source[i][j] = S;
+		}
+	}
+}
+
+/* Bilinear interpolation of the field lattice onto the cells of a tile,
+ * between the centres of the periodic field cells. */
+void Sim::prolongate(size_t t) {
+	size_t i0, i1, j0, j1;
+	tile_bounds(t, i0, i1, j0, j1);
+
+	for(size_t i = i0 * coarsen; i < i1 * coarsen; ++i) {
+		const Interp& r = interp[i];
+		float* nutr = nutrient[i];
+		float* at = attr[i];
+
+		for(size_t j = j0 * coarsen; j < j1 * coarsen; ++j) {
+			const Interp& c = interp[j];
+			float w00 = (1.0f - r.w) * (1.0f - c.w);
+			float w01 = (1.0f - r.w) * c.w;
+			float w10 = r.w * (1.0f - c.w);
+			float w11 = r.w * c.w;
+
+			nutr[j] = w00 * field_nutr[r.lo][c.lo] + w01 * field_nutr[r.lo][c.hi] +
+				w10 * field_nutr[r.hi][c.lo] + w11 * field_nutr[r.hi][c.hi];
+			at[j] = w00 * field_attr[r.lo][c.lo] + w01 * field_attr[r.lo][c.hi] +
+				w10 * field_attr[r.hi][c.lo] + w11 * field_attr[r.hi][c.hi];
+		}
+	}
+}
+
+/* Hands the solved fields to the rules: on the cell lattice itself the
+ * views just follow the buffer the solvers left the latest iterate in.
+ * Otherwise every tile next to a re-solved one is interpolated anew, as
+ * its cells take part of their values from the neighbouring field cells. */
+void Sim::sync_fields(bool all) {
+	if(coarsen == 1) {
+		nutrient = field_nutr;
+		attr = field_attr;
+		return;
+	}
+
+	long n_rows = static_cast<long>(tile_rows);
+	long n_cols = static_cast<long>(tile_cols);
+	std::vector<size_t> tiles;
+
+	for(long ti = 0; ti < n_rows; ++ti) {
+		for(long tj = 0; tj < n_cols; ++tj) {
+			bool near = all;
+			for(long di = -1; di <= 1 && !near; ++di) {
+				for(long dj = -1; dj <= 1 && !near; ++dj) {
+					size_t t = (ti + di + n_rows) % n_rows * n_cols + (tj + dj + n_cols) % n_cols;
+					near = act_nutr[t] || act_attr[t];
+				}
+			}
+			if(near) {
+				tiles.push_back(ti * n_cols + tj);
+			}
+		}
+	}
+
+	size_t n_threads = pool->size();
+	pool->run([&](size_t tid) {
+		for(size_t k = tid * tiles.size() / n_threads; k < (tid + 1) * tiles.size() / n_threads; ++k) {
+			prolongate(tiles[k]);
+		}
+	});
+}
+
+void Sim::diffuse() {
+	bool full = !incremental || diff_step % full_solve_every == 0;
+	size_t n_tiles = tile_rows * tile_cols;
+	std::vector<uint8_t> seed_nutr(n_tiles, 0);
+	std::vector<uint8_t> seed_attr(n_tiles, 0);
+	size_t i0, i1, j0, j1;
+	float d_nutr, d_attr;
+
+	/* coefficients only change where cells changed */
+	for(size_t t = 0; t < n_tiles; ++t) {
+		if(dirty[t]) {
+			tile_bounds(t, i0, i1, j0, j1);
+			update_coefficients(i0, i1, j0, j1, d_nutr, d_attr);
+			seed_nutr[t] = d_nutr > dirty_tol;
+			seed_attr[t] = d_attr > dirty_tol;
+			dirty[t] = 0;
+		}
+	}
+
+	/* Diffuse nutrient */
+	if(use_multigrid) {
+		mg.solve(field_nutr, absorb, fixed);
+		nutr_iter = mg.cycles;
+		nutr_res = mg.residual;
+		nutr_capped = mg.residual > mg.tol;
+		act_nutr.assign(n_tiles, 0);
+	} else {
+		select_tiles(seed_nutr, full, act_nutr);
+	}
+
+	/* Diffuse attractant, fused with the explicit nutrient solve */
+	select_tiles(seed_attr, full, act_attr);
+
+	active.clear();
+	for(size_t t = 0; t < n_tiles; ++t) {
+		if(act_nutr[t] || act_attr[t]) {
+			active.push_back(t);
+		}
+	}
+	relax(!use_multigrid);
+	sync_fields(use_multigrid);
+
+	++diff_step;
+}
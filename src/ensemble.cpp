@@ -0,0 +1,261 @@
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include "ensemble.h"
+#include "matio.h"
+#include "settings.h"
+#include "termination.h"
+#include "work_pool.h"
+
+Ensemble::Ensemble(const char* config_file) : cfg(Sim::load_config(config_file)), finished(0) {
+	const libconfig::Setting& root = cfg->getRoot();
+	const libconfig::Setting& parameters = root["parameters"];
+	const libconfig::Setting& sweep = root["sweep"];
+
+	std::string mode, restart_file, vessel_save_file;
+	int n_workers, max_memory, seed;
+	read_setting<int>(sweep, "replicates", replicates);
+	read_setting<std::string>(sweep, "mode", mode);
+	read_setting<int>(sweep, "workers", n_workers);
+	read_setting<int>(sweep, "max_memory", max_memory);
+	read_setting<int>(sweep, "seed", seed);
+	read_setting<std::string>(sweep, "file", file);
+	read_setting<std::string>(root, "restart_file", restart_file);
+	read_setting<std::string>(root, "vessel_save_file", vessel_save_file);
+
+	if(replicates < 1) {
+		std::cerr << "replicates must be positive." << std::endl;
+		throw std::invalid_argument("replicates");
+	}
+	if(mode != "grid" && mode != "list") {
+		std::cerr << "Unknown sweep mode '" << mode << "'." << std::endl;
+		throw std::invalid_argument("mode");
+	}
+	if(n_workers < 0 || max_memory < 0) {
+		std::cerr << "workers and max_memory must not be negative." << std::endl;
+		throw std::invalid_argument("workers");
+	}
+	if(!restart_file.empty()) {
+		std::cerr << "A sweep cannot resume from restart_file." << std::endl;
+		throw std::invalid_argument("restart_file");
+	}
+	/* the replicates share a layout through vessel_load_file instead */
+	if(!vessel_save_file.empty()) {
+		std::cerr << "A sweep cannot write vessel_save_file, every run would replace it." << std::endl;
+		throw std::invalid_argument("vessel_save_file");
+	}
+
+	/* swept parameters, every value list holds numbers of the parameters group */
+	std::vector<std::vector<double>> values;
+	try {
+		const libconfig::Setting& list = sweep["parameters"];
+		for(int k = 0; k < list.getLength(); ++k) {
+			std::string name;
+			read_setting<std::string>(list[k], "name", name);
+			if(!parameters.exists(name.c_str()) || !parameters[name.c_str()].isNumber()) {
+				std::cerr << "Swept parameter '" << name << "' is not a number in the parameters group." << std::endl;
+				throw std::invalid_argument("parameters");
+			}
+
+			const libconfig::Setting& v = list[k]["values"];
+			if(v.getLength() == 0) {
+				std::cerr << "Swept parameter '" << name << "' has no values." << std::endl;
+				throw std::invalid_argument("values");
+			}
+			names.push_back(name);
+			values.emplace_back();
+			for(int m = 0; m < v.getLength(); ++m) {
+				values.back().push_back(v[m].getType() == libconfig::Setting::TypeFloat ?
+						double(v[m]) : static_cast<double>(int(v[m])));
+			}
+		}
+	} catch(const libconfig::SettingNotFoundException &snfex) {
+		std::cerr << "Setting 'parameters' or 'values' not found in the sweep group." << std::endl;
+		throw;
+	} catch(const libconfig::SettingTypeException &stex) {
+		std::cerr << "Wrong type in the swept parameters." << std::endl;
+		throw;
+	}
+
+	/* grid crosses all value lists, list pairs their k-th entries */
+	if(mode == "grid") {
+		combinations.emplace_back();
+		for(auto const& v : values) {
+			std::vector<std::vector<double>> next;
+			for(auto const& c : combinations) {
+				for(double x : v) {
+					next.push_back(c);
+					next.back().push_back(x);
+				}
+			}
+			combinations.swap(next);
+		}
+	} else {
+		size_t n = values.empty() ? 1 : values[0].size();
+		for(auto const& v : values) {
+			if(v.size() != n) {
+				std::cerr << "In list mode all swept parameters need the same number of values." << std::endl;
+				throw std::invalid_argument("values");
+			}
+		}
+		for(size_t m = 0; m < n; ++m) {
+			combinations.emplace_back();
+			for(auto const& v : values) {
+				combinations.back().push_back(v[m]);
+			}
+		}
+	}
+
+	/* consecutive seeds select independent streams of the counter based RNG */
+	if(seed < 0) {
+		seed = static_cast<int>(std::random_device{}() >> 1);
+		std::cout << "seed = " << seed << std::endl;
+	}
+	for(size_t c = 0; c < combinations.size(); ++c) {
+		for(int r = 0; r < replicates; ++r) {
+			int run_seed = static_cast<int>((static_cast<int64_t>(seed) + runs.size()) % std::numeric_limits<int>::max());
+			runs.push_back({c, r, run_seed, 0, -1, {}, {}, {}, {}});
+		}
+	}
+
+	/* libconfig creates the C++ wrappers of its settings on their first
+	 * lookup, which is not thread safe. The first run is set up once here
+	 * so every setting is read before the workers share the config. */
+	Sim first(*cfg, overrides(runs[0]));
+	Termination first_termination(*cfg, first);
+
+	/* the footprint of the first run bounds how many may be alive at once */
+	workers = n_workers > 0 ? static_cast<size_t>(n_workers) : std::max(1u, std::thread::hardware_concurrency());
+	if(max_memory > 0) {
+		size_t bytes = first.memory();
+		size_t fit = static_cast<size_t>(max_memory) * 1024 * 1024 / bytes;
+		if(fit == 0) {
+			std::cerr << "A single run needs " << bytes / (1024 * 1024) + 1 << " MB, more than max_memory." << std::endl;
+			throw std::invalid_argument("max_memory");
+		}
+		workers = std::min(workers, fit);
+	}
+	workers = std::min(workers, runs.size());
+}
+
+/* a run is single threaded, parallelism comes from running many of them */
+Overrides Ensemble::overrides(const Run& run) const {
+	Overrides o;
+	for(size_t k = 0; k < names.size(); ++k) {
+		o[names[k]] = combinations[run.combination][k];
+	}
+	o["seed"] = run.seed;
+	o["threads"] = 1;
+	o["checkpoint_every"] = 0;
+	return o;
+}
+
+void Ensemble::run() {
+	std::cout << runs.size() << " runs (" << combinations.size() << " combinations x " << replicates
+		<< " replicates) on " << workers << " workers" << std::endl;
+
+	WorkPool pool(workers);
+	pool.run(runs.size(), [this](size_t task, size_t) { execute(runs[task]); });
+
+	write();
+}
+
+void Ensemble::execute(Run& run) {
+	Sim sim(*cfg, overrides(run));
+	Termination termination(*cfg, sim);
+
+	run.num_healthy.reserve(sim.n_steps);
+	run.num_tumor.reserve(sim.n_steps);
+	run.num_deadtumor.reserve(sim.n_steps);
+	run.num_immune.reserve(sim.n_steps);
+
+	for(int n = 0; n < sim.n_steps; ++n) {
+		sim.run_step();
+
+		run.num_healthy.push_back(sim.num_healthy);
+		run.num_tumor.push_back(sim.num_tumor);
+		run.num_deadtumor.push_back(sim.num_deadtumor);
+		run.num_immune.push_back(sim.num_immune);
+
+		/* a settled run ends here, its worker moves on to the next pending one */
+		if(termination.update(sim)) {
+			run.stopped_by = termination.stopped_by();
+			break;
+		}
+
+		sim.next_step();
+	}
+	run.steps = static_cast<int>(run.num_tumor.size());
+
+	std::lock_guard<std::mutex> lock(mtx);
+	++finished;
+	std::cout << "run " << finished << "/" << runs.size() << ": combination " << run.combination
+		<< ", replicate " << run.replicate << ", " << run.steps << " steps"
+		<< (run.stopped_by < 0 ? "" : ", stopped: " + termination.reason()) << std::endl;
+}
+
+/* Time series are stored one run per column and padded with -1 after the
+ * last step of a run. The swept values, replicate, seed and the position
+ * of the termination condition that ended run k (-1 if it ran to the end)
+ * are in row k of the per-run vectors. */
+void Ensemble::write() {
+	mat_t* mat_file = Mat_CreateVer(file.c_str(), NULL, MAT_FT_MAT73);
+	if(mat_file == NULL) {
+		std::cerr << "Cannot create '" << file << "'." << std::endl;
+		throw std::runtime_error("sweep file");
+	}
+
+	size_t n_runs = runs.size();
+	size_t n_steps = 0;
+	for(auto const& r : runs) {
+		n_steps = std::max(n_steps, r.num_tumor.size());
+	}
+
+	auto write_var = [&](const char* name, matio_classes cls, matio_types type, size_t rows, size_t cols, void* data) {
+		size_t dims[2] = {rows, cols};
+		matvar_t* var = Mat_VarCreate(name, cls, type, 2, dims, data, MAT_F_DONT_COPY_DATA);
+		Mat_VarWrite(mat_file, var, MAT_COMPRESSION_ZLIB);
+		Mat_VarFree(var);
+	};
+
+	std::vector<int32_t> combination, replicate, seed, steps, stopped_by;
+	for(auto const& r : runs) {
+		combination.push_back(static_cast<int32_t>(r.combination));
+		replicate.push_back(r.replicate);
+		seed.push_back(r.seed);
+		steps.push_back(r.steps);
+		stopped_by.push_back(r.stopped_by);
+	}
+	write_var("combination", MAT_C_INT32, MAT_T_INT32, n_runs, 1, combination.data());
+	write_var("replicate", MAT_C_INT32, MAT_T_INT32, n_runs, 1, replicate.data());
+	write_var("seed", MAT_C_INT32, MAT_T_INT32, n_runs, 1, seed.data());
+	write_var("steps", MAT_C_INT32, MAT_T_INT32, n_runs, 1, steps.data());
+	write_var("stopped_by", MAT_C_INT32, MAT_T_INT32, n_runs, 1, stopped_by.data());
+
+	std::vector<double> param(n_runs);
+	for(size_t k = 0; k < names.size(); ++k) {
+		for(size_t m = 0; m < n_runs; ++m) {
+			param[m] = combinations[runs[m].combination][k];
+		}
+		std::string name = "param_" + names[k];
+		write_var(name.c_str(), MAT_C_DOUBLE, MAT_T_DOUBLE, n_runs, 1, param.data());
+	}
+
+	std::vector<int32_t> series(n_steps * n_runs);
+	auto write_series = [&](const char* name, std::vector<int32_t> Run::*field) {
+		std::fill(series.begin(), series.end(), -1);
+		for(size_t m = 0; m < n_runs; ++m) {
+			const std::vector<int32_t>& s = runs[m].*field;
+			std::copy(s.begin(), s.end(), series.begin() + m * n_steps);
+		}
+		write_var(name, MAT_C_INT32, MAT_T_INT32, n_steps, n_runs, series.data());
+	};
+	write_series("num_healthy", &Run::num_healthy);
+	write_series("num_tumor", &Run::num_tumor);
+	write_series("num_deadtumor", &Run::num_deadtumor);
+	write_series("num_immune", &Run::num_immune);
+
+	Mat_Close(mat_file);
+}
@@ -0,0 +1,234 @@
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "frame_file.h"
+
+namespace frame_file {
+	static size_t round_up(size_t n, size_t align) {
+		return (n + align - 1) / align * align;
+	}
+
+	Layout::Layout(size_t rows, size_t cols) {
+		size_t n = rows * cols;
+		cells = 0;
+		immune = round_up(cells + n, 64);
+		nutrient = round_up(immune + n, 64);
+		attr = round_up(nutrient + n * sizeof(float), 64);
+		ecm_stress = round_up(attr + n * sizeof(float), 64);
+		bytes = round_up(ecm_stress + n * sizeof(float), 64);
+	}
+}
+
+using namespace frame_file;
+
+FrameWriter::FrameWriter(const std::string& path, size_t size, size_t rows, size_t row0, size_t capacity, uint64_t first_step) :
+	layout(rows, size), frame(layout.bytes, 0)
+{
+	if(first_step > 0) {
+		resume(path, size, rows, row0, first_step);
+		return;
+	}
+
+	fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0) {
+		std::cerr << "Cannot create frame file '" << path << "'." << std::endl;
+		throw std::runtime_error("frame file");
+	}
+
+	size_t index_offset = header_bytes;
+	size_t data_offset = round_up(index_offset + capacity * sizeof(uint64_t), header_bytes);
+	if(ftruncate(fd, static_cast<off_t>(data_offset)) != 0) {
+		close(fd);
+		std::cerr << "Cannot map frame file '" << path << "'." << std::endl;
+		throw std::runtime_error("frame file");
+	}
+	map(path, data_offset);
+
+	std::memcpy(header->magic, magic, sizeof(magic));
+	header->version = version;
+	header->size = static_cast<uint32_t>(size);
+	header->rows = static_cast<uint32_t>(rows);
+	header->row0 = static_cast<uint32_t>(row0);
+	header->frame_bytes = layout.bytes;
+	header->index_offset = index_offset;
+	header->data_offset = data_offset;
+	header->capacity = capacity;
+	header->n_frames = 0;
+	header->n_params = 0;
+}
+
+/* maps the first bytes of the file, header and index */
+void FrameWriter::map(const std::string& path, size_t bytes) {
+	map_bytes = bytes;
+
+	void* p = mmap(nullptr, map_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(p == MAP_FAILED) {
+		close(fd);
+		std::cerr << "Cannot map frame file '" << path << "'." << std::endl;
+		throw std::runtime_error("frame file");
+	}
+
+	header = static_cast<Header*>(p);
+	index = reinterpret_cast<uint64_t*>(static_cast<char*>(p) + header_bytes);
+}
+
+/* The file of the interrupted run: it has to hold the same rows, the
+ * frames it wrote after the checkpoint are cut off. */
+void FrameWriter::resume(const std::string& path, size_t size, size_t rows, size_t row0, uint64_t first_step) {
+	fd = open(path.c_str(), O_RDWR);
+	if(fd < 0) {
+		std::cerr << "Cannot open frame file '" << path << "' to resume it." << std::endl;
+		throw std::runtime_error("frame file");
+	}
+
+	Header h;
+	struct stat st;
+	if(fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < header_bytes || pread(fd, &h, sizeof(h), 0) != sizeof(h)) {
+		close(fd);
+		std::cerr << "Frame file '" << path << "' is truncated." << std::endl;
+		throw std::runtime_error("frame file");
+	}
+	if(std::memcmp(h.magic, magic, sizeof(magic)) != 0 || h.version != version || h.size != size || h.rows != rows
+			|| h.row0 != row0 || h.frame_bytes != layout.bytes || h.index_offset != header_bytes) {
+		close(fd);
+		std::cerr << "'" << path << "' is no frame file of this run." << std::endl;
+		throw std::runtime_error("frame file");
+	}
+
+	/* a frame counts once its data lies in the file */
+	if(h.data_offset > static_cast<size_t>(st.st_size)) {
+		close(fd);
+		std::cerr << "Frame file '" << path << "' is truncated." << std::endl;
+		throw std::runtime_error("frame file");
+	}
+	uint64_t complete = (static_cast<size_t>(st.st_size) - h.data_offset) / h.frame_bytes;
+	map(path, h.data_offset);
+	uint64_t k = 0;
+	while(k < std::min(header->n_frames, complete) && index[k] < first_step) {
+		++k;
+	}
+	header->n_frames = k;
+	if(ftruncate(fd, static_cast<off_t>(header->data_offset + k * header->frame_bytes)) != 0) {
+		std::cerr << "Cannot cut frame file '" << path << "' back to step " << first_step << "." << std::endl;
+		throw std::runtime_error("frame file");
+	}
+}
+
+FrameWriter::~FrameWriter() {
+	msync(header, map_bytes, MS_SYNC);
+	munmap(header, map_bytes);
+	close(fd);
+}
+
+/* a resumed file already holds the parameters, they are overwritten */
+Param& FrameWriter::next_param(const char* name) {
+	for(uint32_t k = 0; k < header->n_params; ++k) {
+		if(std::strncmp(header->params[k].name, name, sizeof(header->params[k].name) - 1) == 0) {
+			return header->params[k];
+		}
+	}
+	if(header->n_params == max_params) {
+		std::cerr << "Too many parameters for the frame file header." << std::endl;
+		throw std::runtime_error("frame file");
+	}
+
+	Param& p = header->params[header->n_params++];
+	std::strncpy(p.name, name, sizeof(p.name) - 1);
+	return p;
+}
+
+void FrameWriter::add_param(const char* name, int value) {
+	Param& p = next_param(name);
+	p.is_float = 0;
+	p.i = value;
+}
+
+void FrameWriter::add_param(const char* name, float value) {
+	Param& p = next_param(name);
+	p.is_float = 1;
+	p.f = value;
+}
+
+void FrameWriter::write(uint64_t step, const int32_t* cells, const int32_t* immune,
+		const float* nutrient, const float* attr, const float* ecm_stress) {
+	uint64_t k = header->n_frames;
+	size_t n = static_cast<size_t>(header->rows) * header->size;
+
+	if(k == header->capacity) {
+		std::cerr << "Frame file is full after " << k << " frames." << std::endl;
+		throw std::runtime_error("frame file");
+	}
+
+	/* the cell codes fit in a byte */
+	for(size_t c = 0; c < n; ++c) {
+		frame[layout.cells + c] = static_cast<char>(cells[c]);
+		frame[layout.immune + c] = static_cast<char>(immune[c]);
+	}
+	std::memcpy(frame.data() + layout.nutrient, nutrient, n * sizeof(float));
+	std::memcpy(frame.data() + layout.attr, attr, n * sizeof(float));
+	std::memcpy(frame.data() + layout.ecm_stress, ecm_stress, n * sizeof(float));
+
+	off_t offset = static_cast<off_t>(header->data_offset + k * header->frame_bytes);
+	for(size_t done = 0; done < frame.size(); ) {
+		ssize_t w = pwrite(fd, frame.data() + done, frame.size() - done, offset + static_cast<off_t>(done));
+		if(w < 0) {
+			std::cerr << "Writing frame " << k << " failed." << std::endl;
+			throw std::runtime_error("frame file");
+		}
+		done += static_cast<size_t>(w);
+	}
+
+	/* publish the frame only after its data and index entry are in place */
+	index[k] = step;
+	std::atomic_ref<uint64_t>(header->n_frames).store(k + 1, std::memory_order_release);
+}
+
+FrameReader::FrameReader(const std::string& path) : layout(0, 0) {
+	fd = open(path.c_str(), O_RDONLY);
+	if(fd < 0) {
+		std::cerr << "Cannot open frame file '" << path << "'." << std::endl;
+		throw std::runtime_error("frame file");
+	}
+
+	struct stat st;
+	void* p = MAP_FAILED;
+	if(fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= header_bytes) {
+		map_bytes = static_cast<size_t>(st.st_size);
+		p = mmap(nullptr, map_bytes, PROT_READ, MAP_SHARED, fd, 0);
+	}
+	if(p == MAP_FAILED) {
+		close(fd);
+		std::cerr << "Cannot map frame file '" << path << "'." << std::endl;
+		throw std::runtime_error("frame file");
+	}
+
+	base = static_cast<const char*>(p);
+	header = reinterpret_cast<const Header*>(base);
+	if(std::memcmp(header->magic, magic, sizeof(magic)) != 0 || header->version != version) {
+		munmap(p, map_bytes);
+		close(fd);
+		std::cerr << "'" << path << "' is not a frame file of version " << version << "." << std::endl;
+		throw std::runtime_error("frame file");
+	}
+
+	index = reinterpret_cast<const uint64_t*>(base + header->index_offset);
+	layout = Layout(header->rows, header->size);
+}
+
+FrameReader::~FrameReader() {
+	munmap(const_cast<char*>(base), map_bytes);
+	close(fd);
+}
+
+/* frames that are complete and inside the mapped part of the file */
+size_t FrameReader::frames() const {
+	uint64_t n = std::atomic_ref<const uint64_t>(header->n_frames).load(std::memory_order_acquire);
+	uint64_t mapped = map_bytes > header->data_offset ? (map_bytes - header->data_offset) / header->frame_bytes : 0;
+	return static_cast<size_t>(std::min(n, mapped));
+}
@@ -0,0 +1,186 @@
+#include "sim.h"
+
+/* Exchanges between the strips of a distributed run. A rule that acts on
+ * a halo row does not change it, it hands the change to the owner of the
+ * row instead, which applies it once its own strip is done. Where two
+ * changes compete for the same cell the owner takes them in the visiting
+ * order of a single process, the lowest key first. */
+namespace {
+	template<class T>
+	std::vector<char> pack(const std::vector<T>& items) {
+		std::vector<char> buf(items.size() * sizeof(T));
+		std::memcpy(buf.data(), items.data(), buf.size());
+		return buf;
+	}
+
+	template<class T>
+	std::vector<T> unpack(const std::vector<char>& buf) {
+		std::vector<T> items(buf.size() / sizeof(T));
+		std::memcpy(items.data(), buf.data(), items.size() * sizeof(T));
+		return items;
+	}
+
+	/* Sends each item to the strip above or below and returns what both
+	 * neighbours sent, the ones from above first */
+	template<class T, class Above>
+	std::vector<std::pair<T, bool>> trade(Domain& domain, const std::vector<T>& items, Above above) {
+		std::vector<T> to_prev, to_next;
+		for(auto const& it : items) {
+			(above(it) ? to_prev : to_next).push_back(it);
+		}
+
+		std::vector<char> from_prev, from_next;
+		domain.trade(pack(to_prev), pack(to_next), from_prev, from_next);
+
+		std::vector<std::pair<T, bool>> in;
+		for(auto const& it : unpack<T>(from_prev)) {
+			in.push_back({it, true});
+		}
+		for(auto const& it : unpack<T>(from_next)) {
+			in.push_back({it, false});
+		}
+		return in;
+	}
+}
+
+template<class T>
+void Sim::swap_halo(Grid<T>& g) {
+	size_t n = g.rows();
+	domain->exchange(g[1], g[n-2], g[0], g[n-1], g.cols() * sizeof(T));
+}
+
+template void Sim::swap_halo(Grid<Cell>& g);
+template void Sim::swap_halo(Grid<float>& g);
+
+void Sim::swap_halo(BitGrid& g) {
+	domain->exchange(g.row(1), g.row(rows-2), g.row(0), g.row(rows-1), g.row_bytes());
+}
+
+/* ECM stress on the rows of the neighbours. The increments are added in
+ * the row-major order of their sources like on a single lattice, so the
+ * ones of this strip on its first row wait for those from above. */
+void Sim::send_stress(const std::vector<Stress>& out, const std::vector<Stress>& first_row) {
+	auto in = trade(*domain, out, [this](const Stress& s) { return s.pos / size < row0; });
+
+	auto add = [this](const Stress& s) {
+		size_t i = local_row(s.pos / size);
+		size_t j = s.pos % size;
+		ecm_stress[i][j] += s.value;
+		stressed_set.insert(i*size + j);
+	};
+
+	auto below = std::find_if(in.begin(), in.end(), [](auto const& s) { return !s.second; });
+	for(auto it = in.begin(); it != below; ++it) {
+		add(it->first);
+	}
+	for(auto const& s : first_row) {
+		add(s);
+	}
+	for(auto it = below; it != in.end(); ++it) {
+		add(it->first);
+	}
+}
+
+/* Immune cells moving onto the rows of the neighbours. The owner takes
+ * every cell whose target is still free and reports back which ones it
+ * took, the sender then removes those. The count does not change. */
+void Sim::send_immune(const std::vector<Emigrant>& out) {
+	auto above = [this](const Emigrant& e) { return e.to / size < row0; };
+	auto in = trade(*domain, out, above);
+	std::sort(in.begin(), in.end(), [](auto const& a, auto const& b) { return a.first.key < b.first.key; });
+
+	std::vector<Emigrant> taken;
+	for(auto const& e : in) {
+		size_t i = local_row(e.first.to / size);
+		size_t j = e.first.to % size;
+		if(immune.test(i, j)) {
+			continue;
+		}
+
+		mark_dirty(i, j);
+		immune_set.insert(i*size + j);
+		immune.set(i, j);
+		kill_cnt[i][j] = e.first.kill_cnt;
+		life_cnt[i][j] = e.first.life_cnt;
+
+		/* addressed back to the sender */
+		taken.push_back(e.first);
+		taken.back().to = e.second ? 0 : size * size;
+	}
+
+	auto left = trade(*domain, taken, [](const Emigrant& e) { return e.to == 0; });
+	for(auto const& e : left) {
+		size_t i = e.first.from / size;
+		size_t j = e.first.from % size;
+
+		mark_dirty(i, j);
+		immune_set.erase(i*size + j);
+		immune.reset(i, j);
+		kill_cnt[i][j] = 0;
+		life_cnt[i][j] = 0;
+	}
+}
+
+/* Daughter cells placed on the rows of the neighbours, the owner takes
+ * those whose target is still empty and the parents of these start
+ * their next cycle. The others try again in the next step. */
+void Sim::send_daughters(const std::vector<Daughter>& out) {
+	auto above = [this](const Daughter& d) { return d.to / size < row0; };
+	auto in = trade(*domain, out, above);
+	std::sort(in.begin(), in.end(), [](auto const& a, auto const& b) { return a.first.key < b.first.key; });
+
+	std::vector<Daughter> taken;
+	for(auto const& d : in) {
+		size_t i = local_row(d.first.to / size);
+		size_t j = d.first.to % size;
+		if(cells[i][j] != Cell::Empty) {
+			continue;
+		}
+
+		mark_dirty(i, j);
+		cells[i][j] = Cell::Tumor;
+		if(in_window(i, j)) {
+			++num_tumor;
+		}
+		tumor_set.insert(i*size + j);
+		update_border(i, j);
+		prolif_cnt[i][j] = d.first.prolif_cnt;
+
+		taken.push_back(d.first);
+		taken.back().to = d.second ? 0 : size * size;
+	}
+
+	auto born = trade(*domain, taken, [](const Daughter& d) { return d.to == 0; });
+	for(auto const& d : born) {
+		prolif_cnt[d.first.from / size][d.first.from % size] = d.first.parent_cnt;
+	}
+}
+
+/* End of a distributed step: the halo rows take the new cell states, the
+ * border set follows them on the edge rows of the strip and the counters
+ * add up the changes of all strips. */
+void Sim::sync_strips() {
+	swap_halo(cells);
+	swap_halo(immune);
+
+	for(size_t j = 0; j < size; ++j) {
+		update_border(0, j);
+		update_border(rows-1, j);
+	}
+
+	reduce_counts();
+}
+
+void Sim::reduce_counts() {
+	int* num[4] = {&num_healthy, &num_tumor, &num_deadtumor, &num_immune};
+	int64_t delta[4];
+
+	for(int k = 0; k < 4; ++k) {
+		delta[k] = *num[k] - synced[k];
+	}
+	domain->sum(delta, 4);
+	for(int k = 0; k < 4; ++k) {
+		*num[k] = synced[k] + static_cast<int>(delta[k]);
+		synced[k] = *num[k];
+	}
+}
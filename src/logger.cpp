@@ -1,27 +1,75 @@
+#include <cstdio>
+#include <fstream>
 #include "logger.h"
 #include "matio.h"
 #include "sim.h"
 
-Logger::Logger(Sim& sim) {
-	mat_file = Mat_CreateVer(sim.mat_file.c_str(), NULL, MAT_FT_MAT73);
-	num_file = Mat_CreateVer(sim.num_file.c_str(), NULL, MAT_FT_MAT73);
+Logger::Logger(Sim& sim) :
+	sim(sim), mat_file(NULL), num_file(NULL), quantize_bits(sim.quantize_bits), delta(sim.delta_cells), rec{}, dropped(0), frames_failed(false), stop(false)
+{
+	/* every strip of a distributed run writes its own rows, the counters
+	 * are those of the whole lattice and only written once */
+	rows = sim.rows - 2*sim.halo;
+	lead = !sim.domain || sim.domain->rank() == 0;
+
+	/* A restarted run continues the output of the interrupted one from the
+	 * step of its checkpoint. MAT snapshots can only be appended to, so an
+	 * existing snapshot file is never overwritten. */
+	uint64_t resume = sim.restart_file.empty() ? 0 : sim.step;
+
+	/* raw frames are stored unencoded, ca_sim_convert turns them into the MAT layout */
+	if(sim.output_format == "raw") {
+		size_t capacity = sim.log_mat ? sim.n_steps / sim.log_step + 1 : 0;
+		frames = std::make_unique<FrameWriter>(sim.raw_file, sim.size, rows, sim.row0, capacity, resume);
+		quantize_bits = 0;
+		delta = false;
+	} else if(resume == 0 || sim.log_mat) {
+		if(resume > 0 && std::ifstream(sim.mat_file)) {
+			std::cerr << "A restart cannot continue the snapshots in '" << sim.mat_file
+				<< "', move it away or use output_format raw." << std::endl;
+			throw std::runtime_error("mat_file");
+		}
+		mat_file = Mat_CreateVer(sim.mat_file.c_str(), NULL, MAT_FT_MAT73);
+	}
 	
-	size_t dims[3] = {sim.size, sim.size, 1};
+	/* the variables point at the buffer being written, set per frame */
+	size_t dims_m[3] = {sim.size, sim.size, 1};
 	size_t dims_1[2] = {1, 1};
+	size_t dims_q[2] = {1, 3};
+	int grid_size = static_cast<int>(sim.size);
+	int delta_cells = delta;
+
+	/* cell layers as differences to the previous frame fit in int8 */
+	matio_classes cell_class = delta ? MAT_C_INT8 : MAT_C_INT32;
+	matio_types cell_type = delta ? MAT_T_INT8 : MAT_T_INT32;
+	matio_classes field_class = quantize_bits == 8 ? MAT_C_UINT8 : quantize_bits == 16 ? MAT_C_UINT16 : MAT_C_SINGLE;
+	matio_types field_type = quantize_bits == 8 ? MAT_T_UINT8 : quantize_bits == 16 ? MAT_T_UINT16 : MAT_T_SINGLE;
+
+	cells_var = Mat_VarCreate("cells", cell_class, cell_type, 3, dims_m, NULL, MAT_F_DONT_COPY_DATA);
+	immune_var = Mat_VarCreate("immune", cell_class, cell_type, 3, dims_m, NULL, MAT_F_DONT_COPY_DATA);
+	nutrient_var = Mat_VarCreate("nutrient", field_class, field_type, 3, dims_m, NULL, MAT_F_DONT_COPY_DATA);
+	attr_var = Mat_VarCreate("attr", field_class, field_type, 3, dims_m, NULL, MAT_F_DONT_COPY_DATA);
+	ecm_var = Mat_VarCreate("ecm_stress", field_class, field_type, 3, dims_m, NULL, MAT_F_DONT_COPY_DATA);
+	quant_scale_var = Mat_VarCreate("quant_scale", MAT_C_SINGLE, MAT_T_SINGLE, 2, dims_q, quant_scale, MAT_F_DONT_COPY_DATA);
+	quant_offset_var = Mat_VarCreate("quant_offset", MAT_C_SINGLE, MAT_T_SINGLE, 2, dims_q, quant_offset, MAT_F_DONT_COPY_DATA);
+	num_healthy_var = Mat_VarCreate("num_healthy", MAT_C_INT32, MAT_T_INT32, 2, dims_1, &(rec.num_healthy), MAT_F_DONT_COPY_DATA);
+	num_tumor_var = Mat_VarCreate("num_tumor", MAT_C_INT32, MAT_T_INT32, 2, dims_1, &(rec.num_tumor), MAT_F_DONT_COPY_DATA);
+	num_deadtumor_var = Mat_VarCreate("num_deadtumor", MAT_C_INT32, MAT_T_INT32, 2, dims_1, &(rec.num_deadtumor), MAT_F_DONT_COPY_DATA);
+	num_immune_var = Mat_VarCreate("num_immune", MAT_C_INT32, MAT_T_INT32, 2, dims_1, &(rec.num_immune), MAT_F_DONT_COPY_DATA);
+	nutr_iter_var = Mat_VarCreate("nutr_iter", MAT_C_INT32, MAT_T_INT32, 2, dims_1, &(rec.nutr_iter), MAT_F_DONT_COPY_DATA);
+	nutr_res_var = Mat_VarCreate("nutr_res", MAT_C_SINGLE, MAT_T_SINGLE, 2, dims_1, &(rec.nutr_res), MAT_F_DONT_COPY_DATA);
 
-	cells_var = Mat_VarCreate("cells", MAT_C_INT32, MAT_T_INT32, 3, dims, &(sim.cells), MAT_F_DONT_COPY_DATA);
-	immune_var = Mat_VarCreate("immune", MAT_C_INT32, MAT_T_INT32, 3, dims, &(sim.immune), MAT_F_DONT_COPY_DATA);
-	nutrient_var = Mat_VarCreate("nutrient", MAT_C_SINGLE, MAT_T_SINGLE, 3, dims, &(sim.nutrient), MAT_F_DONT_COPY_DATA);
-	attr_var = Mat_VarCreate("attr", MAT_C_SINGLE, MAT_T_SINGLE, 3, dims, &(sim.attr), MAT_F_DONT_COPY_DATA);
-	ecm_var = Mat_VarCreate("ecm_stress", MAT_C_SINGLE, MAT_T_SINGLE, 3, dims, &(sim.ecm_stress), MAT_F_DONT_COPY_DATA);
-	num_healthy_var = Mat_VarCreate("num_healthy", MAT_C_INT32, MAT_T_INT32, 2, dims_1, &(sim.num_healthy), MAT_F_DONT_COPY_DATA);
-	num_tumor_var = Mat_VarCreate("num_tumor", MAT_C_INT32, MAT_T_INT32, 2, dims_1, &(sim.num_tumor), MAT_F_DONT_COPY_DATA);
-	num_deadtumor_var = Mat_VarCreate("num_deadtumor", MAT_C_INT32, MAT_T_INT32, 2, dims_1, &(sim.num_deadtumor), MAT_F_DONT_COPY_DATA);
-	num_immune_var = Mat_VarCreate("num_immune", MAT_C_INT32, MAT_T_INT32, 2, dims_1, &(sim.num_immune), MAT_F_DONT_COPY_DATA);
+	if(lead) {
+		num_file = resume > 0 ? resume_num(resume) : Mat_CreateVer(sim.num_file.c_str(), NULL, MAT_FT_MAT73);
+	}
 
+	saveParam(&grid_size, "grid_size");
 	saveParam(&(sim.sim_time), "sim_time");
 	saveParam(&(sim.dt), "dt");
 	saveParam(&(sim.log_step), "log_step");
+	saveParam(&(sim.seed), "seed");
+	saveParam(&quantize_bits, "quantize_bits");
+	saveParam(&delta_cells, "delta_cells");
 
 	saveParam(&(sim.alpha2), "alpha2");
 	saveParam(&(sim.lambda), "lambda");
@@ -36,10 +84,52 @@ Logger::Logger(Sim& sim) {
 	saveParam(&(sim.init_immune_ratio), "init_immune_ratio");
 	saveParam(&(sim.kill_limit), "kill_limit");
 	saveParam(&(sim.life_limit), "life_limit");
+
+	/* snapshot ring, only needed when fields are logged */
+	cells_comp = compression("cells");
+	immune_comp = compression("immune");
+	nutrient_comp = compression("nutrient");
+	attr_comp = compression("attr");
+	ecm_comp = compression("ecm_stress");
+
+	drop_full = sim.snapshot_policy == "drop";
+	if(sim.log_mat) {
+		size_t n = rows * sim.size;
+		snapshots.resize(sim.snapshot_buffers);
+		for(size_t k = 0; k < snapshots.size(); ++k) {
+			snapshots[k].cells.resize(n);
+			snapshots[k].immune.resize(n);
+			snapshots[k].nutrient.resize(n);
+			snapshots[k].attr.resize(n);
+			snapshots[k].ecm_stress.resize(n);
+			free_bufs.push_back(k);
+		}
+
+		prev_cells.assign(n, 0);
+		prev_immune.assign(n, 0);
+		delta_buf.resize(delta ? n : 0);
+		quant8.resize(quantize_bits == 8 ? n : 0);
+		quant16.resize(quantize_bits == 16 ? n : 0);
+	}
+
+	writer = std::thread(&Logger::write_loop, this);
 }
 
 Logger::~Logger() {
+	/* the writer drains the queue before it exits */
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		stop = true;
+	}
+	cv_job.notify_one();
+	writer.join();
+
+	if(dropped > 0) {
+		std::cerr << dropped << " snapshots dropped, the writer could not keep up." << std::endl;
+	}
+
 	Mat_VarFree(cells_var);
+	Mat_VarFree(immune_var);
 	Mat_VarFree(nutrient_var);
 	Mat_VarFree(attr_var);
 	Mat_VarFree(ecm_var);
@@ -47,38 +137,265 @@ Logger::~Logger() {
 	Mat_VarFree(num_tumor_var);
 	Mat_VarFree(num_deadtumor_var);
 	Mat_VarFree(num_immune_var);
+	Mat_VarFree(nutr_iter_var);
+	Mat_VarFree(nutr_res_var);
+	Mat_VarFree(quant_scale_var);
+	Mat_VarFree(quant_offset_var);
 
-	Mat_Close(mat_file);
-	Mat_Close(num_file);
+	if(mat_file) {
+		Mat_Close(mat_file);
+	}
+	if(num_file) {
+		Mat_Close(num_file);
+	}
 }
 
 void Logger::saveParam(int* var, const char* name) {
 	size_t param_dim[2] = {1, 1};
 	matvar_t* param_var = Mat_VarCreate(name, MAT_C_INT32, MAT_T_INT32, 2, param_dim, var, 0);
-	Mat_VarWrite(mat_file, param_var, MAT_COMPRESSION_NONE);
-	Mat_VarWrite(num_file, param_var, MAT_COMPRESSION_NONE);
+	if(frames) {
+		frames->add_param(name, *var);
+	} else if(mat_file) {
+		Mat_VarWrite(mat_file, param_var, MAT_COMPRESSION_NONE);
+	}
+	if(num_file) {
+		Mat_VarWrite(num_file, param_var, MAT_COMPRESSION_NONE);
+	}
 	Mat_VarFree(param_var);
 }
 
 void Logger::saveParam(float* var, const char* name) {
 	size_t param_dim[2] = {1, 1};
 	matvar_t* param_var = Mat_VarCreate(name, MAT_C_SINGLE, MAT_T_SINGLE, 2, param_dim, var, 0);
-	Mat_VarWrite(mat_file, param_var, MAT_COMPRESSION_NONE);
-	Mat_VarWrite(num_file, param_var, MAT_COMPRESSION_NONE);
+	if(frames) {
+		frames->add_param(name, *var);
+	} else if(mat_file) {
+		Mat_VarWrite(mat_file, param_var, MAT_COMPRESSION_NONE);
+	}
+	if(num_file) {
+		Mat_VarWrite(num_file, param_var, MAT_COMPRESSION_NONE);
+	}
 	Mat_VarFree(param_var);
 }
 
+/* The num file is rewritten with the first steps entries of every
+ * series, the ones after the checkpoint are dropped. The copy replaces
+ * the file once it is complete. */
+mat_t* Logger::resume_num(uint64_t steps) {
+	mat_t* old = Mat_Open(sim.num_file.c_str(), MAT_ACC_RDONLY);
+	if(old == NULL) {
+		std::cerr << "Cannot open '" << sim.num_file << "' to resume it." << std::endl;
+		throw std::runtime_error("num_file");
+	}
+
+	std::string tmp = sim.num_file + ".tmp";
+	mat_t* mat = Mat_CreateVer(tmp.c_str(), NULL, MAT_FT_MAT73);
+	matvar_t* series[] = {num_healthy_var, num_tumor_var, num_deadtumor_var, num_immune_var, nutr_iter_var, nutr_res_var};
+	for(matvar_t* var : series) {
+		matvar_t* prev = Mat_VarRead(old, var->name);
+		if(prev == NULL || prev->rank != 2 || prev->dims[1] < steps || prev->class_type != var->class_type) {
+			Mat_VarFree(prev);
+			Mat_Close(old);
+			Mat_Close(mat);
+			std::remove(tmp.c_str());
+			std::cerr << "'" << sim.num_file << "' holds no " << var->name << " for the " << steps << " steps before the restart." << std::endl;
+			throw std::runtime_error("num_file");
+		}
+
+		size_t dims[2] = {1, static_cast<size_t>(steps)};
+		matvar_t* kept = Mat_VarCreate(var->name, var->class_type, var->data_type, 2, dims, prev->data, MAT_F_DONT_COPY_DATA);
+		Mat_VarWriteAppend(mat, kept, MAT_COMPRESSION_NONE, 2);
+		Mat_VarFree(kept);
+		Mat_VarFree(prev);
+	}
+	Mat_Close(old);
+
+	/* the open file stays valid under its new name */
+	if(std::rename(tmp.c_str(), sim.num_file.c_str()) != 0) {
+		Mat_Close(mat);
+		std::cerr << "Cannot replace '" << sim.num_file << "'." << std::endl;
+		throw std::runtime_error("num_file");
+	}
+	return mat;
+}
+
 void Logger::log_num() {
+	if(!lead) {
+		return;
+	}
+
+	Job job{};
+	job.mat = false;
+	job.rec = {sim.num_healthy, sim.num_tumor, sim.num_deadtumor, sim.num_immune, sim.nutr_iter, sim.nutr_res};
+	push(job);
+}
+
+void Logger::log_mat() {
+	if(frames_failed) {
+		return;
+	}
+
+	Job job{};
+	job.mat = true;
+	job.step = sim.step;
+
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		if(free_bufs.empty() && drop_full) {
+			++dropped;
+			return;
+		}
+		cv_free.wait(lock, [&] { return !free_bufs.empty(); });
+		job.buf = free_bufs.back();
+		free_bufs.pop_back();
+	}
+
+	/* the buffer is owned by this thread until it is queued */
+	copy(snapshots[job.buf]);
+	push(job);
+}
+
+/* packs the padded rows and widens the compact cell layers to int32 */
+void Logger::copy(Snapshot& snap) {
+	size_t n = sim.size;
+
+	for(size_t k = 0; k < rows; ++k) {
+		size_t i = k + sim.halo;
+		const Cell* c = sim.cells[i];
+		int32_t* dst_c = snap.cells.data() + k * n;
+		int32_t* dst_i = snap.immune.data() + k * n;
+
+		for(size_t j = 0; j < n; ++j) {
+			dst_c[j] = static_cast<int32_t>(c[j]);
+			dst_i[j] = sim.immune.test(i, j) ? static_cast<int32_t>(Cell::Immune) : 0;
+		}
+
+		std::memcpy(snap.nutrient.data() + k * n, sim.nutrient[i], n * sizeof(float));
+		std::memcpy(snap.attr.data() + k * n, sim.attr[i], n * sizeof(float));
+		std::memcpy(snap.ecm_stress.data() + k * n, sim.ecm_stress[i], n * sizeof(float));
+	}
+}
+
+void Logger::push(const Job& job) {
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		jobs.push_back(job);
+	}
+	cv_job.notify_one();
+}
+
+void Logger::write_loop() {
+	for(;;) {
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			cv_job.wait(lock, [&] { return stop || !jobs.empty(); });
+			if(jobs.empty()) {
+				return;
+			}
+			job = jobs.front();
+			jobs.pop_front();
+		}
+
+		if(job.mat) {
+			write_mat(snapshots[job.buf], job.step);
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				free_bufs.push_back(job.buf);
+			}
+			cv_free.notify_one();
+		} else {
+			write_num(job.rec);
+		}
+	}
+}
+
+matio_compression Logger::compression(const char* name) {
+	auto const& list = sim.compress_fields;
+	return std::find(list.begin(), list.end(), name) != list.end() ? MAT_COMPRESSION_ZLIB : MAT_COMPRESSION_NONE;
+}
+
+/* Encoding and (zlib) compression run here, on the writer thread */
+void Logger::write_mat(Snapshot& snap, uint64_t step) {
+	/* A full file or disk ends the raw frames but not the run, the
+	 * checkpoints and the num file go on. */
+	if(frames) {
+		if(!frames_failed) {
+			try {
+				frames->write(step, snap.cells.data(), snap.immune.data(), snap.nutrient.data(), snap.attr.data(), snap.ecm_stress.data());
+			} catch(const std::runtime_error&) {
+				std::cerr << "No further frames are written to '" << sim.raw_file << "' from step " << step << " on." << std::endl;
+				frames_failed = true;
+			}
+		}
+		return;
+	}
+
+	write_cells(cells_var, snap.cells, prev_cells, cells_comp);
+	write_cells(immune_var, snap.immune, prev_immune, immune_comp);
+	write_field(nutrient_var, snap.nutrient, 0, nutrient_comp);
+	write_field(attr_var, snap.attr, 1, attr_comp);
+	write_field(ecm_var, snap.ecm_stress, 2, ecm_comp);
+
+	if(quantize_bits > 0) {
+		Mat_VarWriteAppend(mat_file, quant_scale_var, MAT_COMPRESSION_NONE, 1);
+		Mat_VarWriteAppend(mat_file, quant_offset_var, MAT_COMPRESSION_NONE, 1);
+	}
+}
+
+/* In delta mode a frame holds the change against the previous written
+ * frame, mostly zeros, the layers are recovered by a cumulative sum. */
+void Logger::write_cells(matvar_t* var, const std::vector<int32_t>& cur, std::vector<int32_t>& prev, matio_compression comp) {
+	if(delta) {
+		for(size_t k = 0; k < cur.size(); ++k) {
+			delta_buf[k] = static_cast<int8_t>(cur[k] - prev[k]);
+		}
+		prev = cur;
+		var->data = delta_buf.data();
+	} else {
+		var->data = const_cast<int32_t*>(cur.data());
+	}
+
+	Mat_VarWriteAppend(mat_file, var, comp, 3);
+}
+
+/* Lossy mode maps [min, max] of the frame linearly onto the integer
+ * range, value = q * quant_scale + quant_offset. */
+template<class Q>
+static void quantize(const std::vector<float>& in, std::vector<Q>& out, float& scale, float& offset) {
+	auto range = std::minmax_element(in.begin(), in.end());
+	float levels = static_cast<float>(std::numeric_limits<Q>::max());
+
+	offset = *range.first;
+	scale = (*range.second - *range.first) / levels;
+	float inv = scale > 0.0f ? 1.0f / scale : 0.0f;
+
+	for(size_t k = 0; k < in.size(); ++k) {
+		out[k] = static_cast<Q>(std::min(levels, std::round((in[k] - offset) * inv)));
+	}
+}
+
+void Logger::write_field(matvar_t* var, std::vector<float>& data, size_t k, matio_compression comp) {
+	if(quantize_bits == 8) {
+		quantize(data, quant8, quant_scale[k], quant_offset[k]);
+		var->data = quant8.data();
+	} else if(quantize_bits == 16) {
+		quantize(data, quant16, quant_scale[k], quant_offset[k]);
+		var->data = quant16.data();
+	} else {
+		var->data = data.data();
+	}
+
+	Mat_VarWriteAppend(mat_file, var, comp, 3);
+}
+
+void Logger::write_num(const Record& r) {
+	rec = r;
+
 	Mat_VarWriteAppend(num_file, num_healthy_var, MAT_COMPRESSION_NONE, 2);
 	Mat_VarWriteAppend(num_file, num_tumor_var, MAT_COMPRESSION_NONE, 2);
 	Mat_VarWriteAppend(num_file, num_deadtumor_var, MAT_COMPRESSION_NONE, 2);
 	Mat_VarWriteAppend(num_file, num_immune_var, MAT_COMPRESSION_NONE, 2);
-}
-
-void Logger::log_mat() {
-	Mat_VarWriteAppend(mat_file, cells_var, MAT_COMPRESSION_NONE, 3);
-	Mat_VarWriteAppend(mat_file, immune_var, MAT_COMPRESSION_NONE, 3);
-	Mat_VarWriteAppend(mat_file, nutrient_var, MAT_COMPRESSION_NONE, 3);
-	Mat_VarWriteAppend(mat_file, attr_var, MAT_COMPRESSION_NONE, 3);
-	Mat_VarWriteAppend(mat_file, ecm_var, MAT_COMPRESSION_NONE, 3);
+	Mat_VarWriteAppend(num_file, nutr_iter_var, MAT_COMPRESSION_NONE, 2);
+	Mat_VarWriteAppend(num_file, nutr_res_var, MAT_COMPRESSION_NONE, 2);
 }
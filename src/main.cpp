@@ -1,40 +1,42 @@
 #include <iostream>
 #include "logger.h"
 #include "sim.h"
+#include "termination.h"
+#include "trace.h"
 
 char config_file[] = "../config.cfg";
 
 int main(int argc, char** argv)
 {
-	Sim sim(config_file);
+	auto cfg = Sim::load_config(config_file);
+	Sim sim(*cfg);
+	Termination termination(*cfg, sim);
+	Trace trace(*cfg, sim);
 
 	Logger logger(sim);
 
-	for(int n = 0; n < sim.n_steps; ++n) {
-		sim.damage_ecm();
-		sim.diffuse();
-
-		sim.move_immune();
-		sim.recruit_immune();
-		sim.kill_tumor();
-		sim.kill_immune();
-		sim.kill_healthy();
-		sim.proliferate();
-		sim.count_cells();
+	for(int n = static_cast<int>(sim.current_step()); n < sim.n_steps; ++n) {
+		sim.run_step();
 
+		Trace::Clock::time_point t0 = trace.start();
 		logger.log_num();
 
 		if(sim.log_mat && n % sim.log_step == 0) {
 			logger.log_mat();
 		}
+		trace.stop(Trace::Log, t0);
+		trace.end_step();
 
 		if(n % 100 == 0) {
 			std::cout << "n = " << n << std::endl;
 		}
 
-		if(sim.tumor_killed()) {
+		if(termination.update(sim)) {
+			std::cout << "stopped at n = " << n << ": " << termination.reason() << std::endl;
 			break;
 		}
+
+		sim.next_step();
 	}
 
 	return 0;
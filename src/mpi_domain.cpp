@@ -0,0 +1,61 @@
+#include <climits>
+#include <iostream>
+#include <stdexcept>
+#include "mpi_domain.h"
+
+namespace {
+	/* separate tags keep both directions apart when prev and next are the same rank */
+	enum Tag { ToPrev = 1, ToNext = 2, SizeToPrev = 3, SizeToNext = 4 };
+
+	int count(size_t bytes) {
+		if(bytes > static_cast<size_t>(INT_MAX)) {
+			std::cerr << "Message of " << bytes << " bytes too large for MPI." << std::endl;
+			throw std::length_error("mpi message");
+		}
+		return static_cast<int>(bytes);
+	}
+}
+
+MpiDomain::MpiDomain(MPI_Comm comm) : comm(comm) {
+	MPI_Comm_rank(comm, &me);
+	MPI_Comm_size(comm, &n);
+	prev = (me + n - 1) % n;
+	next = (me + 1) % n;
+}
+
+/* two ring shifts, each one a Sendrecv that cannot deadlock */
+void MpiDomain::exchange(const void* first, const void* last, void* above, void* below, size_t row_bytes) {
+	int c = count(row_bytes);
+
+	MPI_Sendrecv(first, c, MPI_BYTE, prev, ToPrev, below, c, MPI_BYTE, next, ToPrev, comm, MPI_STATUS_IGNORE);
+	MPI_Sendrecv(last, c, MPI_BYTE, next, ToNext, above, c, MPI_BYTE, prev, ToNext, comm, MPI_STATUS_IGNORE);
+}
+
+void MpiDomain::trade(const std::vector<char>& to_prev, const std::vector<char>& to_next,
+		std::vector<char>& from_prev, std::vector<char>& from_next) {
+	uint64_t out_prev = to_prev.size();
+	uint64_t out_next = to_next.size();
+	uint64_t in_prev, in_next;
+
+	MPI_Sendrecv(&out_prev, 1, MPI_UINT64_T, prev, SizeToPrev, &in_next, 1, MPI_UINT64_T, next, SizeToPrev, comm, MPI_STATUS_IGNORE);
+	MPI_Sendrecv(&out_next, 1, MPI_UINT64_T, next, SizeToNext, &in_prev, 1, MPI_UINT64_T, prev, SizeToNext, comm, MPI_STATUS_IGNORE);
+
+	from_prev.resize(in_prev);
+	from_next.resize(in_next);
+	MPI_Sendrecv(to_prev.data(), count(out_prev), MPI_BYTE, prev, ToPrev,
+			from_next.data(), count(in_next), MPI_BYTE, next, ToPrev, comm, MPI_STATUS_IGNORE);
+	MPI_Sendrecv(to_next.data(), count(out_next), MPI_BYTE, next, ToNext,
+			from_prev.data(), count(in_prev), MPI_BYTE, prev, ToNext, comm, MPI_STATUS_IGNORE);
+}
+
+void MpiDomain::max(float* v, size_t count) {
+	MPI_Allreduce(MPI_IN_PLACE, v, static_cast<int>(count), MPI_FLOAT, MPI_MAX, comm);
+}
+
+void MpiDomain::min(uint64_t* v, size_t count) {
+	MPI_Allreduce(MPI_IN_PLACE, v, static_cast<int>(count), MPI_UINT64_T, MPI_MIN, comm);
+}
+
+void MpiDomain::sum(int64_t* v, size_t count) {
+	MPI_Allreduce(MPI_IN_PLACE, v, static_cast<int>(count), MPI_INT64_T, MPI_SUM, comm);
+}
@@ -0,0 +1,72 @@
+#include <iostream>
+#include <memory>
+#include <mpi.h>
+#include "logger.h"
+#include "mpi_domain.h"
+#include "sim.h"
+#include "termination.h"
+#include "trace.h"
+
+char config_file[] = "../config.cfg";
+
+/* Distributed run, each MPI process owns a strip of rows of the lattice.
+ * Only the thread stepping the Sim talks to the other processes, which
+ * is the main thread. Every process sees the counters of the whole
+ * lattice, so all of them end the run at the same step. */
+int main(int argc, char** argv)
+{
+	int provided, rank, ranks;
+	MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+
+	try {
+		auto cfg = Sim::load_config(config_file);
+		MpiDomain domain(MPI_COMM_WORLD);
+		Sim sim(*cfg, Overrides(), ranks > 1 ? &domain : nullptr);
+		Termination termination(*cfg, sim);
+
+		/* the phase times of the first strip stand for the run */
+		std::unique_ptr<Trace> trace;
+		if(rank == 0) {
+			trace = std::make_unique<Trace>(*cfg, sim);
+		}
+
+		Logger logger(sim);
+
+		for(int n = static_cast<int>(sim.current_step()); n < sim.n_steps; ++n) {
+			sim.run_step();
+
+			Trace::Clock::time_point t0 = trace ? trace->start() : Trace::Clock::time_point();
+			logger.log_num();
+
+			if(sim.log_mat && n % sim.log_step == 0) {
+				logger.log_mat();
+			}
+			if(trace) {
+				trace->stop(Trace::Log, t0);
+				trace->end_step();
+			}
+
+			if(rank == 0 && n % 100 == 0) {
+				std::cout << "n = " << n << std::endl;
+			}
+
+			if(termination.update(sim)) {
+				if(rank == 0) {
+					std::cout << "stopped at n = " << n << ": " << termination.reason() << std::endl;
+				}
+				break;
+			}
+
+			sim.next_step();
+		}
+	} catch(const std::exception& e) {
+		/* the other processes would wait for this one forever */
+		std::cerr << "rank " << rank << ": " << e.what() << std::endl;
+		MPI_Abort(MPI_COMM_WORLD, 1);
+	}
+
+	MPI_Finalize();
+	return 0;
+}
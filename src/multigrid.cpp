@@ -0,0 +1,192 @@
+#include <algorithm>
+#include <cmath>
+#include "multigrid.h"
+
+Multigrid::Multigrid() :
+	cycle(Cycle::V), max_cycles(50), smooth_steps(2), coarse_steps(64), tol(1e-6f),
+	cycles(0), residual(0.0f) {}
+
+void Multigrid::map_fields(Arena& arena, size_t size) {
+	levels.clear();
+
+	/* the finest level borrows u, a and fixed from the caller */
+	Level fine;
+	fine.n = size;
+	fine.h2 = 1.0f;
+	fine.f = arena.grid<float>(size, size);
+	fine.r = arena.grid<float>(size, size);
+	levels.push_back(fine);
+
+	/* coarsen while the periodic lattice halves evenly */
+	for(size_t n = size; n % 2 == 0 && n >= 8; ) {
+		n /= 2;
+
+		Level lv;
+		lv.n = n;
+		lv.h2 = levels.back().h2 * 4.0f;
+		lv.u = arena.grid<float>(n, n);
+		lv.f = arena.grid<float>(n, n);
+		lv.r = arena.grid<float>(n, n);
+		lv.a = arena.grid<float>(n, n);
+		lv.fixed = arena.grid<uint8_t>(n, n);
+		levels.push_back(lv);
+	}
+}
+
+void Multigrid::solve(Grid<float>& u, const Grid<float>& absorb, const Grid<uint8_t>& fixed) {
+	Level& fine = levels[0];
+	fine.u = u;
+	fine.a = absorb;
+	fine.fixed = fixed;
+
+	build_coarse();
+
+	residual = compute_residual(fine);
+	for(cycles = 0; cycles < max_cycles && residual > tol; ++cycles) {
+		run_cycle(0, cycle);
+		residual = compute_residual(fine);
+	}
+}
+
+void Multigrid::build_coarse() {
+	for(size_t l = 1; l < levels.size(); ++l) {
+		const Level& fine = levels[l-1];
+		Level& lv = levels[l];
+
+		/* a fixed fine cell acts as a strong sink for the error on coarser levels */
+		float penalty = 4.0f / fine.h2;
+
+		for(size_t i = 0; i < lv.n; ++i) {
+			for(size_t j = 0; j < lv.n; ++j) {
+				float a = 0.0f;
+				int n_fixed = 0;
+
+				for(size_t di = 0; di < 2; ++di) {
+					for(size_t dj = 0; dj < 2; ++dj) {
+						if(fine.fixed[2*i+di][2*j+dj]) {
+							a += penalty;
+							++n_fixed;
+						} else {
+							a += fine.a[2*i+di][2*j+dj];
+						}
+					}
+				}
+
+				lv.a[i][j] = a / 4.0f;
+				lv.fixed[i][j] = n_fixed == 4;
+			}
+		}
+	}
+}
+
+void Multigrid::run_cycle(size_t l, Cycle type) {
+	Level& lv = levels[l];
+
+	if(l == levels.size() - 1) {
+		for(int k = 0; k < coarse_steps; ++k) {
+			smooth(lv);
+		}
+		return;
+	}
+
+	for(int k = 0; k < smooth_steps; ++k) {
+		smooth(lv);
+	}
+
+	Level& coarse = levels[l+1];
+	compute_residual(lv);
+	restrict_residual(lv, coarse);
+
+	run_cycle(l+1, type);
+	if(type == Cycle::F) {
+		run_cycle(l+1, Cycle::V);
+	}
+
+	prolongate(coarse, lv);
+
+	for(int k = 0; k < smooth_steps; ++k) {
+		smooth(lv);
+	}
+}
+
+/* red-black Gauss-Seidel */
+void Multigrid::smooth(Level& lv) {
+	size_t n = lv.n;
+
+	for(size_t color = 0; color < 2; ++color) {
+		for(size_t i = 0; i < n; ++i) {
+			size_t i_m = (i + n - 1) % n;
+			size_t i_p = (i + 1) % n;
+
+			for(size_t j = (i + color) % 2; j < n; j += 2) {
+				if(lv.fixed[i][j]) {
+					continue;
+				}
+
+				size_t j_m = (j + n - 1) % n;
+				size_t j_p = (j + 1) % n;
+				float sum = lv.u[i_m][j] + lv.u[i_p][j] + lv.u[i][j_m] + lv.u[i][j_p];
+
+				lv.u[i][j] = (sum + lv.h2 * lv.f[i][j]) / (4.0f + lv.h2 * lv.a[i][j]);
+			}
+		}
+	}
+}
+
+float Multigrid::compute_residual(Level& lv) {
+	size_t n = lv.n;
+	float max_r = 0.0f;
+
+	for(size_t i = 0; i < n; ++i) {
+		size_t i_m = (i + n - 1) % n;
+		size_t i_p = (i + 1) % n;
+
+		for(size_t j = 0; j < n; ++j) {
+			if(lv.fixed[i][j]) {
+				lv.r[i][j] = 0.0f;
+				continue;
+			}
+
+			size_t j_m = (j + n - 1) % n;
+			size_t j_p = (j + 1) % n;
+			float lap = (lv.u[i_m][j] + lv.u[i_p][j] + lv.u[i][j_m] + lv.u[i][j_p] - 4.0f * lv.u[i][j]) / lv.h2;
+
+			lv.r[i][j] = lv.f[i][j] + lap - lv.a[i][j] * lv.u[i][j];
+			max_r = std::max(max_r, std::abs(lv.r[i][j]));
+		}
+	}
+
+	return max_r;
+}
+
+void Multigrid::restrict_residual(const Level& fine, Level& coarse) {
+	for(size_t i = 0; i < coarse.n; ++i) {
+		for(size_t j = 0; j < coarse.n; ++j) {
+			coarse.u[i][j] = 0.0f;
+			coarse.f[i][j] = coarse.fixed[i][j] ? 0.0f :
+				(fine.r[2*i][2*j] + fine.r[2*i][2*j+1] + fine.r[2*i+1][2*j] + fine.r[2*i+1][2*j+1]) / 4.0f;
+		}
+	}
+}
+
+/* bilinear interpolation of the cell-centred coarse correction */
+void Multigrid::prolongate(const Level& coarse, Level& fine) {
+	size_t n = coarse.n;
+
+	for(size_t i = 0; i < fine.n; ++i) {
+		size_t ci = i / 2;
+		size_t ci_n = (i % 2) ? (ci + 1) % n : (ci + n - 1) % n;
+
+		for(size_t j = 0; j < fine.n; ++j) {
+			if(fine.fixed[i][j]) {
+				continue;
+			}
+
+			size_t cj = j / 2;
+			size_t cj_n = (j % 2) ? (cj + 1) % n : (cj + n - 1) % n;
+
+			fine.u[i][j] += 0.5625f * coarse.u[ci][cj] + 0.1875f * (coarse.u[ci_n][cj] + coarse.u[ci][cj_n])
+				+ 0.0625f * coarse.u[ci_n][cj_n];
+		}
+	}
+}
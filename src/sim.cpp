@@ -1,13 +1,11 @@
 #include "sim.h"
 
-Sim::Sim(char* config_file) : 
-	gen(std::chrono::system_clock::now().time_since_epoch().count())
-{
-	libconfig::Config cfg;
+std::unique_ptr<libconfig::Config> Sim::load_config(const char* config_file) {
+	auto cfg = std::make_unique<libconfig::Config>();
 
 	/* read configuration file */
 	try {
-		cfg.readFile(config_file);
+		cfg->readFile(config_file);
 	} catch(const libconfig::FileIOException &fioex) {
 		std::cerr << "I/O error while reading configuration file." << std::endl;
 		throw;
@@ -17,12 +15,25 @@ Sim::Sim(char* config_file) :
 		throw;
 	}
 
+	return cfg;
+}
+
+Sim::Sim(const char* config_file) : Sim(*load_config(config_file)) {}
+
+Sim::Sim(const libconfig::Config& cfg, const Overrides& overrides, Domain* domain) : overrides(overrides), domain(domain) {
 	const libconfig::Setting& root = cfg.getRoot();
 	const libconfig::Setting& parameters = root["parameters"];
 
 	/* read all parameters */
+	read_param<size_t>(parameters, "size", size);
+	read_param<int>(parameters, "neighbourhood", neighbourhood);
 	read_param<std::string>(root, "mat_file", mat_file);
 	read_param<std::string>(root, "num_file", num_file);
+	read_param<std::string>(root, "raw_file", raw_file);
+	read_param<std::string>(root, "checkpoint_file", checkpoint_file);
+	read_param<std::string>(root, "restart_file", restart_file);
+	read_param<std::string>(root, "vessel_load_file", vessel_load_file);
+	read_param<std::string>(root, "vessel_save_file", vessel_save_file);
 	read_param<float>(parameters, "alpha2", alpha2);
 	read_param<float>(parameters, "lambda", lambda);
 	read_param<float>(parameters, "beta2", beta2);
@@ -35,25 +46,300 @@ Sim::Sim(char* config_file) :
 	read_param<float>(parameters, "dt", dt);
 	read_param<int>(parameters, "log_step", log_step);
 	read_param<bool>(parameters, "log_mat", log_mat);
+	read_param<std::string>(parameters, "output_format", output_format);
+	read_param<int>(parameters, "snapshot_buffers", snapshot_buffers);
+	read_param<std::string>(parameters, "snapshot_policy", snapshot_policy);
+	read_param<int>(parameters, "quantize_bits", quantize_bits);
+	read_param<bool>(parameters, "delta_cells", delta_cells);
 	read_param<int>(parameters, "t_cycle", t_cycle);
 	read_param<int>(parameters, "kill_limit", kill_limit);
 	read_param<int>(parameters, "life_limit", life_limit);
 	read_param<bool>(parameters, "vessels_on_borders", vessels_on_borders);
 	read_param<float>(parameters, "vessel_num", vessel_num);
+	read_param<float>(parameters, "tumor_radius", tumor_radius);
+	read_param<int>(parameters, "seed", seed);
+	read_param<int>(parameters, "checkpoint_every", checkpoint_every);
+	read_param<bool>(parameters, "checkpoint_async", checkpoint_async);
+	read_param<std::string>(parameters, "move_mode", move_mode);
+	read_param<bool>(parameters, "check_counts", check_counts);
+
+	std::string diff_solver, mg_cycle, diff_accel, diff_residual;
+	read_param<std::string>(parameters, "diff_solver", diff_solver);
+	read_param<std::string>(parameters, "diff_accel", diff_accel);
+	read_param<std::string>(parameters, "diff_residual", diff_residual);
+	read_param<float>(parameters, "nutr_tol", nutr_tol);
+	read_param<float>(parameters, "attr_tol", attr_tol);
+	read_param<std::string>(parameters, "mg_cycle", mg_cycle);
+	read_param<float>(parameters, "mg_tol", mg.tol);
+	read_param<int>(parameters, "mg_max_cycles", mg.max_cycles);
+	read_param<int>(parameters, "mg_smooth", mg.smooth_steps);
+	read_param<int>(parameters, "threads", threads);
+	read_param<size_t>(parameters, "tile_size", tile_size);
+	read_param<std::string>(parameters, "simd", simd);
+	read_param<bool>(parameters, "incremental", incremental);
+	read_param<size_t>(parameters, "dirty_pad", dirty_pad);
+	read_param<float>(parameters, "dirty_tol", dirty_tol);
+	read_param<size_t>(parameters, "time_block", time_block);
+	read_param<size_t>(parameters, "field_coarsen", coarsen);
+	read_param<int>(parameters, "diff_neighbourhood", diff_neighbourhood);
+	read_param<int>(parameters, "full_solve_every", full_solve_every);
+
+	if(output_format != "mat" && output_format != "raw") {
+		std::cerr << "Unknown output_format '" << output_format << "'." << std::endl;
+		throw std::invalid_argument("output_format");
+	}
+	if(snapshot_buffers < 1) {
+		std::cerr << "snapshot_buffers must be positive." << std::endl;
+		throw std::invalid_argument("snapshot_buffers");
+	}
+	if(snapshot_policy != "block" && snapshot_policy != "drop") {
+		std::cerr << "Unknown snapshot_policy '" << snapshot_policy << "'." << std::endl;
+		throw std::invalid_argument("snapshot_policy");
+	}
+	if(quantize_bits != 0 && quantize_bits != 8 && quantize_bits != 16) {
+		std::cerr << "quantize_bits must be 0, 8 or 16." << std::endl;
+		throw std::invalid_argument("quantize_bits");
+	}
+
+	/* snapshot layers written with zlib compression */
+	try {
+		const libconfig::Setting& compress = parameters["compress"];
+		for(int k = 0; k < compress.getLength(); ++k) {
+			std::string name = compress[k];
+			if(name != "cells" && name != "immune" && name != "nutrient" && name != "attr" && name != "ecm_stress") {
+				std::cerr << "Unknown layer '" << name << "' in compress." << std::endl;
+				throw std::invalid_argument("compress");
+			}
+			compress_fields.push_back(name);
+		}
+	} catch(const libconfig::SettingNotFoundException &snfex) {
+		std::cerr << "Setting 'compress' not found in configuration file." << std::endl;
+		throw;
+	} catch(const libconfig::SettingTypeException &stex) {
+		std::cerr << "Wrong type in compress." << std::endl;
+		throw;
+	}
+
+	if(diff_solver != "rk4" && diff_solver != "multigrid") {
+		std::cerr << "Unknown diff_solver '" << diff_solver << "'." << std::endl;
+		throw std::invalid_argument("diff_solver");
+	}
+	if(mg_cycle != "V" && mg_cycle != "F") {
+		std::cerr << "Unknown mg_cycle '" << mg_cycle << "'." << std::endl;
+		throw std::invalid_argument("mg_cycle");
+	}
+	if(move_mode != "sequential" && move_mode != "parallel") {
+		std::cerr << "Unknown move_mode '" << move_mode << "'." << std::endl;
+		throw std::invalid_argument("move_mode");
+	}
+	if(diff_accel != "none" && diff_accel != "chebyshev") {
+		std::cerr << "Unknown diff_accel '" << diff_accel << "'." << std::endl;
+		throw std::invalid_argument("diff_accel");
+	}
+	if(diff_residual != "absolute" && diff_residual != "relative") {
+		std::cerr << "Unknown diff_residual '" << diff_residual << "'." << std::endl;
+		throw std::invalid_argument("diff_residual");
+	}
+	if(nutr_tol < 0.0f || attr_tol < 0.0f) {
+		std::cerr << "nutr_tol and attr_tol must not be negative." << std::endl;
+		throw std::invalid_argument("nutr_tol");
+	}
+	use_multigrid = diff_solver == "multigrid";
+	chebyshev = diff_accel == "chebyshev";
+	relative_tol = diff_residual == "relative";
+	nutr_bound = 0.0f;
+	parallel_move = move_mode == "parallel";
+	mg.cycle = mg_cycle == "F" ? Multigrid::Cycle::F : Multigrid::Cycle::V;
+	nutr_iter = 0;
+	nutr_res = 0.0f;
+	attr_iter = 0;
+	attr_res = 0.0f;
+	nutr_capped = false;
+	attr_capped = false;
+
+	if(threads < 1 || tile_size < 1) {
+		std::cerr << "threads and tile_size must be positive." << std::endl;
+		throw std::invalid_argument("threads");
+	}
+	pool = std::make_unique<ThreadPool>(threads);
+	kernels = Stencil::select(simd, diff_neighbourhood);
+	float_floor = diff_neighbourhood != 4;
+
+	/* variants of the rules, one instance per neighbourhood */
+	static const std::pair<int, Rules> variants[] = {
+		{4, rules_for<VonNeumann>()},
+		{6, rules_for<Hexagonal>()},
+		{8, rules_for<Moore>()}
+	};
+	auto variant = std::find_if(std::begin(variants), std::end(variants), [this](auto const& v) { return v.first == neighbourhood; });
+	if(variant == std::end(variants)) {
+		std::cerr << "neighbourhood must be 4, 6 or 8." << std::endl;
+		throw std::invalid_argument("neighbourhood");
+	}
+	rules = variant->second;
+	if(use_multigrid && diff_neighbourhood != 4) {
+		std::cerr << "diff_solver multigrid needs diff_neighbourhood = 4." << std::endl;
+		throw std::invalid_argument("diff_neighbourhood");
+	}
+
+	if(time_block < 1 || time_block > tile_size) {
+		std::cerr << "time_block must lie between 1 and tile_size." << std::endl;
+		throw std::invalid_argument("time_block");
+	}
+	if(checkpoint_every < 0) {
+		std::cerr << "checkpoint_every must not be negative." << std::endl;
+		throw std::invalid_argument("checkpoint_every");
+	}
+	if(chebyshev && time_block != 1) {
+		std::cerr << "diff_accel chebyshev needs time_block = 1." << std::endl;
+		throw std::invalid_argument("diff_accel");
+	}
+	if(full_solve_every < 1) {
+		std::cerr << "full_solve_every must be positive." << std::endl;
+		throw std::invalid_argument("full_solve_every");
+	}
+	if(coarsen < 1 || size % coarsen != 0) {
+		std::cerr << "field_coarsen must be positive and divide size." << std::endl;
+		throw std::invalid_argument("field_coarsen");
+	}
+	field_size = size / coarsen;
+
+	/* field cells on both sides of each cell centre and the weight of the upper one */
+	for(size_t k = 0; k < size && coarsen > 1; ++k) {
+		float x = (k + 0.5f) / coarsen - 0.5f;
+		float lo = std::floor(x);
+		uint32_t l = static_cast<uint32_t>((static_cast<long>(lo) + field_size) % field_size);
+		interp.push_back({l, static_cast<uint32_t>((l + 1) % field_size), x - lo});
+	}
+
+	/* Strip of a distributed run, rows split as evenly as possible. The
+	 * solvers and migration modes that need the whole lattice at once are
+	 * not available there, and every step re-solves all tiles. */
+	if(domain) {
+		size_t n = domain->ranks();
+		size_t k = domain->rank();
+		if(size < 2*n) {
+			std::cerr << "size must give every process at least two rows." << std::endl;
+			throw std::invalid_argument("size");
+		}
+		if(use_multigrid || time_block != 1 || coarsen != 1 || parallel_move || incremental) {
+			std::cerr << "A distributed run needs diff_solver rk4, time_block = 1, field_coarsen = 1, "
+				<< "move_mode sequential and incremental = false." << std::endl;
+			throw std::invalid_argument("domain");
+		}
+		if(log_mat && output_format != "raw") {
+			std::cerr << "A distributed run writes its snapshots with output_format raw." << std::endl;
+			throw std::invalid_argument("output_format");
+		}
+		if(!vessel_save_file.empty()) {
+			std::cerr << "A distributed run cannot write vessel_save_file, it can read vessel_load_file." << std::endl;
+			throw std::invalid_argument("vessel_save_file");
+		}
+		row0 = size * k / n;
+		rows = size * (k + 1) / n - row0 + 2;
+		halo = 1;
+	} else {
+		row0 = 0;
+		rows = size;
+		halo = 0;
+	}
+	field_rows = (rows - 2*halo) / coarsen + 2*halo;
+
+	/* every strip keeps its own checkpoint and snapshot file */
+	if(domain) {
+		std::string suffix = "." + std::to_string(domain->rank());
+		if(!checkpoint_file.empty()) {
+			checkpoint_file += suffix;
+		}
+		if(!restart_file.empty()) {
+			restart_file += suffix;
+		}
+		raw_file += suffix;
+	}
+
+	tile_rows = (field_rows - 2*halo + tile_size - 1) / tile_size;
+	tile_cols = (field_size + tile_size - 1) / tile_size;
+	dirty.assign(tile_rows * tile_cols, 1);
+	/* every tile counts as re-solved until the first solve selects them */
+	act_nutr.assign(tile_rows * tile_cols, 1);
+	act_attr.assign(tile_rows * tile_cols, 1);
+	diff_step = 0;
 	
+	/* region of the lattice num_tumor counts, -1 extends it to the edge */
+	try {
+		const libconfig::Setting& window = parameters["count_window"];
+		if(window.getLength() != 4) {
+			std::cerr << "count_window needs four entries: i0, i1, j0, j1." << std::endl;
+			throw std::invalid_argument("count_window");
+		}
+		int w[4];
+		for(int k = 0; k < 4; ++k) {
+			w[k] = window[k];
+		}
+		window_i0 = static_cast<size_t>(std::max(w[0], 0));
+		window_i1 = w[1] < 0 ? size : static_cast<size_t>(w[1]);
+		window_j0 = static_cast<size_t>(std::max(w[2], 0));
+		window_j1 = w[3] < 0 ? size : static_cast<size_t>(w[3]);
+	} catch(const libconfig::SettingNotFoundException &snfex) {
+		std::cerr << "Setting 'count_window' not found in configuration file." << std::endl;
+		throw;
+	} catch(const libconfig::SettingTypeException &stex) {
+		std::cerr << "Wrong type in count_window." << std::endl;
+		throw;
+	}
+
+	/* a negative seed draws one, it is logged so the run can be repeated */
+	if(seed < 0) {
+		seed = static_cast<int>(std::random_device{}() >> 1);
+
+		/* every process draws one, all of them take the smallest */
+		if(domain) {
+			uint64_t s = static_cast<uint64_t>(seed);
+			domain->min(&s, 1);
+			seed = static_cast<int>(s);
+		}
+		if(!domain || domain->rank() == 0) {
+			std::cout << "seed = " << seed << std::endl;
+		}
+	}
+	rng = Rng(seed);
+	step = 0;
+
 	t_steps = static_cast<int>(t_cycle * 60.0f / dt);
 	n_steps = static_cast<int>(sim_time * 60.0f / dt);
+	tumor_history.reserve(std::max(n_steps, 0));
 	life_steps = static_cast<int>(life_limit * 24 * 60.0f / dt);
+
+	/* the per-cell counters are stored in 16 bits */
+	if(t_steps > INT16_MAX || life_steps > INT16_MAX || kill_limit > INT16_MAX || 2 * 60.0f / dt > INT16_MAX) {
+		std::cerr << "t_cycle, life_limit or kill_limit too large for dt." << std::endl;
+		throw std::invalid_argument("dt");
+	}
+
+	/* lay out all layers in one arena, the first pass only measures it */
+	map_fields();
+	arena.allocate();
+	map_fields();
 	
 	/* fill simulation area with healthy cells */
-	for(size_t i = 0; i < size; ++i) {
+	for(size_t i = 0; i < rows; ++i) {
 		for(size_t j = 0; j < size; ++j) {
 			cells[i][j] = Cell::Healthy;
 		}
 	}
 
 	/* initialize all layers */
-	for(size_t i = 0; i < size; ++i) {
+	for(size_t i = 0; i < field_rows; ++i) {
+		size_t g = global_row(i);
+		for(size_t j = 0; j < field_size; ++j) {
+			field_nutr[i][j] = 0.9;
+			field_attr[i][j] = 0.0;
+
+			/* the attractant is held at its value on the outermost rows and columns */
+			attr_fixed[i][j] = g == 0 || g == field_size-1 || j == 0 || j == field_size-1;
+		}
+	}
+	for(size_t i = 0; i < rows; ++i) {
 		for(size_t j = 0; j < size; ++j) {
 			nutrient[i][j] = 0.9;
 			prolif_cnt[i][j] = 0;
@@ -61,55 +347,130 @@ Sim::Sim(char* config_file) :
 			life_cnt[i][j] = 0;
 			attr[i][j] = 0.0;
 		}
+		for(size_t j = 0; j < claim.cols() && i < claim.rows(); ++j) {
+			claim[i][j] = std::numeric_limits<uint64_t>::max();
+			vacated[i][j] = 0;
+		}
 	}
+
+	/* Initial tumor cells within R rows of the strip, vessels keep this
+	 * distance from them. Tumor cells are only placed on owned rows. */
+	const int R = 10;
+	size_t owned_rows = rows - 2*halo;
+	std::vector<uint8_t> near_tumor((owned_rows + 2*R) * size, 0);
+	int64_t added = 0;
+	auto place_tumor = [&](size_t x, size_t y) {
+		size_t m = x + R - row0;
+		if(m < owned_rows + 2*R) {
+			near_tumor[m * size + y] = 1;
+		}
+		size_t i = local_row(x);
+		if(owned(i)) {
+			cells[i][y] = Cell::Tumor;
+			prolif_cnt[i][y] = Rng::uniform_int(rng(step, x*size + y, Purpose::InitTumor)[0], static_cast<int>(-2 * 60.0f / dt), t_steps);
+		}
+	};
 	
 	/* add tumor cells */
-	std::uniform_int_distribution<int> dist_prolif(static_cast<int>(-2 * 60.0f / dt), t_steps);
 	int init_tumor = parameters["tumor_x"].getLength();
 	int x, y;
 	for(int i = 0; i < init_tumor; ++i) {
 		try {
 			x = parameters["tumor_x"][i];
 			y = parameters["tumor_y"][i];
+			if(x < 0 || y < 0 || static_cast<size_t>(x) >= size || static_cast<size_t>(y) >= size) {
+				std::cerr << "Tumor cell (" << x << ", " << y << ") lies outside the lattice." << std::endl;
+				throw std::invalid_argument("tumor_x");
+			}
 
-			cells[x][y] = Cell::Tumor;
-			prolif_cnt[x][y] = dist_prolif(gen);
+			place_tumor(x, y);
 		} catch(const libconfig::SettingTypeException &stex) {
 			std::cerr << "Wrong type in tumor_x or tumor_y." << std::endl;
 			throw;
 		}
 	}
 
-	/* add blood vessels */
-	if(vessels_on_borders) {
+	/* a disc of tumor around the centre, for larger initial tumors */
+	float c = (size - 1) / 2.0f;
+	size_t g0 = row0 < static_cast<size_t>(R) ? 0 : row0 - R;
+	size_t g1 = std::min(row0 + owned_rows + R, size);
+	for(size_t i = g0; i < g1 && tumor_radius > 0.0f; ++i) {
 		for(size_t j = 0; j < size; ++j) {
-			cells[0][j] = Cell::Vessel;
-			nutrient[0][j] = 1.0f;
-			cells[size-1][j] = Cell::Vessel;
-			nutrient[size-1][j] = 1.0f;
+			size_t m = (i + R - row0) * size + j;
+			if((i - c) * (i - c) + (j - c) * (j - c) <= tumor_radius * tumor_radius && !near_tumor[m]) {
+				added += owned(local_row(i));
+				place_tumor(i, j);
+			}
+		}
+	}
+	if(domain) {
+		domain->sum(&added, 1);
+	}
+	init_tumor += static_cast<int>(added);
+
+	/* add blood vessels */
+	auto place_vessel = [&](size_t i, size_t j) {
+		cells[i][j] = Cell::Vessel;
+		nutrient[i][j] = 1.0f;
+		field_nutr[i / coarsen][j / coarsen] = 1.0f;
+	};
+	if(!vessel_load_file.empty()) {
+		for(uint64_t p : load_vessels(vessel_load_file)) {
+			size_t i = local_row(p / size);
+			size_t j = p % size;
+			if(!owned(i)) {
+				continue;
+			}
+			if(cells[i][j] == Cell::Tumor) {
+				std::cerr << "Vessel (" << p / size << ", " << j << ") of '" << vessel_load_file << "' lies on the initial tumor." << std::endl;
+				throw std::invalid_argument("vessel_load_file");
+			}
+			place_vessel(i, j);
+		}
+	} else if(vessels_on_borders) {
+		for(size_t i = halo; i < rows - halo; ++i) {
+			if(global_row(i) != 0 && global_row(i) != size-1) {
+				continue;
+			}
+			for(size_t j = 0; j < size; ++j) {
+				place_vessel(i, j);
+			}
 		}
 	} else {
-		std::uniform_real_distribution<float> dist_v(0.0f, 1.0f);
 		float thr = vessel_num * static_cast<float>(size*size) / (size*size - init_tumor);
-		int R = 10;
 		bool clear = true;
 		float val;
 
-		for(size_t i = 0; i < size; ++i) {
+		/* Rows to the nearest initial tumor cell of the same column, R+1
+		 * where that is farther than R. A site keeps clear of the tumor
+		 * when n*n + gap*gap > R*R for every column n within R of it,
+		 * 2R+1 lookups in place of a scan of the disc. */
+		std::vector<uint8_t> gap = std::move(near_tumor);
+		size_t region = owned_rows + 2*R;
+		for(size_t m = 0; m < region; ++m) {
+			for(size_t j = 0; j < size; ++j) {
+				uint8_t above = m > 0 ? gap[(m-1) * size + j] : R;
+				gap[m * size + j] = gap[m * size + j] ? 0 : std::min(above + 1, R + 1);
+			}
+		}
+		for(size_t m = region-1; m-- > 0;) {
+			for(size_t j = 0; j < size; ++j) {
+				gap[m * size + j] = std::min(gap[m * size + j], static_cast<uint8_t>(gap[(m+1) * size + j] + 1));
+			}
+		}
+
+		for(size_t i = halo; i < rows - halo; ++i) {
+			const uint8_t* row = &gap[(i - halo + R) * size];
 			for(size_t j = 0; j < size; ++j) {
-				val = dist_v(gen);
+				val = Rng::uniform(rng(step, global_pos(i, j), Purpose::InitVessel)[0]);
 				if((j <= 85 && val < thr) || (j >= 85 && val < 3*thr)) {
 					clear = true;
-					for(int m = -R; m <= R; ++m) {
-						for(int n = -R; n <= R; ++n) {
-							if((m*m + n*n <= R*R) && (i+m >= 0) && (i+m < size) && (j+n >= 0) && (j+n < size) && cells[i+m][j+n] == Cell::Tumor) {
-								clear = false;
-							}
-						}
+					for(int n = -R; n <= R && clear; ++n) {
+						size_t y = j + n;
+						clear = y >= size || n*n + row[y] * row[y] > R*R;
 					}
 					if(clear) {
-						cells[i][j] = Cell::Vessel;
-						nutrient[i][j] = 1.0f;
+						place_vessel(i, j);
 					}
 				}
 			}
@@ -117,24 +478,111 @@ Sim::Sim(char* config_file) :
 	}
 
 	/* add immune cells */
-	std::uniform_real_distribution<float> dist(0.0f, 1.0f);
-	std::uniform_int_distribution<int> dist_int(0, life_steps);
-	for(size_t i = 0; i < size; ++i) {
+	for(size_t i = halo; i < rows - halo; ++i) {
 		for(size_t j = 0; j < size; ++j) {
-			if(dist(gen) < init_immune_ratio) {
-				immune[i][j] = Cell::Immune;
-				life_cnt[i][j] = dist_int(gen);
+			Rng::Block r = rng(step, global_pos(i, j), Purpose::InitImmune);
+			if(Rng::uniform(r[0]) < init_immune_ratio) {
+				immune.set(i, j);
+				life_cnt[i][j] = Rng::uniform_int(r[1], 0, life_steps);
+			}
+		}
+	}
+
+	/* the halo rows mirror the neighbouring strips from here on */
+	if(domain) {
+		swap_halo(cells);
+		swap_halo(immune);
+		swap_halo(field_nutr);
+		swap_halo(field_attr);
+	}
+
+	/* active sets */
+	for(size_t i = halo; i < rows - halo; ++i) {
+		for(size_t j = 0; j < size; ++j) {
+			if(cells[i][j] == Cell::Tumor) {
+				tumor_set.insert(i*size + j);
+				update_border(i, j);
+			} else if(cells[i][j] == Cell::Vessel) {
+				vessels.push_back({i, j});
+			}
+			if(immune.test(i, j)) {
+				immune_set.insert(i*size + j);
 			}
 		}
 	}
 
 	count_cells();
+
+	/* the checkpoint replaces the state set up above, RNG included */
+	if(!restart_file.empty()) {
+		restore(restart_file);
+	}
+	if(!vessel_save_file.empty()) {
+		save_vessels(vessel_save_file);
+	}
+
+	/* recruitment spreads over the vessels of all strips */
+	int64_t n_vessels = vessels.size();
+	if(domain) {
+		domain->sum(&n_vessels, 1);
+	}
+	total_vessels = static_cast<size_t>(n_vessels);
 }
 
-Sim::~Sim() {}
+Sim::~Sim() {
+	if(ckpt_thread.joinable()) {
+		ckpt_thread.join();
+	}
+}
+
+void Sim::map_fields() {
+	cells = arena.grid<Cell>(rows, size);
+	immune = arena.bits(rows, size);
+	prolif_cnt = arena.grid<int16_t>(rows, size);
+	kill_cnt = arena.grid<int16_t>(rows, size);
+	life_cnt = arena.grid<int16_t>(rows, size);
+	field_nutr = arena.grid<float>(field_rows, field_size);
+	field_attr = arena.grid<float>(field_rows, field_size);
+	ecm_stress = arena.grid<float>(rows, size);
+	temp_nutr = arena.grid<float>(field_rows, field_size);
+	temp_attr = arena.grid<float>(field_rows, field_size);
+	absorb = arena.grid<float>(field_rows, field_size);
+	fixed = arena.grid<uint8_t>(field_rows, field_size);
+	source = arena.grid<float>(field_rows, field_size);
+	attr_fixed = arena.grid<uint8_t>(field_rows, field_size);
+	claim = arena.grid<uint64_t>(parallel_move ? rows : 0, size);
+	vacated = arena.grid<uint64_t>(parallel_move ? rows : 0, size);
+	tumor_set.map_fields(arena, rows, size);
+	border_set.map_fields(arena, rows, size);
+	stressed_set.map_fields(arena, rows, size);
+	immune_set.map_fields(arena, rows, size);
+
+	/* the multigrid hierarchy spans the whole lattice, distributed runs never solve with it */
+	if(use_multigrid) {
+		mg.map_fields(arena, field_size);
+	}
+
+	/* the rules read the fields on the cell lattice */
+	if(coarsen == 1) {
+		nutrient = field_nutr;
+		attr = field_attr;
+	} else {
+		nutrient = arena.grid<float>(size, size);
+		attr = arena.grid<float>(size, size);
+	}
+}
 
 template<class T>
 void Sim::read_param(const libconfig::Setting& setting, const char* name, T& var) {
+	/* numeric parameters may be replaced per run, see Ensemble */
+	if constexpr(std::is_arithmetic_v<T>) {
+		auto it = overrides.find(name);
+		if(it != overrides.end()) {
+			var = static_cast<T>(it->second);
+			return;
+		}
+	}
+
 	try {
 		var = T(setting.lookup(name));
 	} catch(const libconfig::SettingNotFoundException &snfex) {
@@ -146,424 +594,735 @@ void Sim::read_param(const libconfig::Setting& setting, const char* name, T& var
 	}
 }
 
-inline void Sim::diffuse_nutr(size_t i, size_t j, float& max_diff) {
-	if(cells[i][j] == Cell::Vessel) {
-		return;
+/* The rules below walk the neighbours of a policy N. Cells in the
+ * outermost rows and columns do not act, so all neighbours of the others
+ * lie on the lattice. Candidates are collected without branching. */
+template<class N>
+void Sim::damage_ecm_on() {
+	int x, y;
+	int n, k;
+	int cand[N::size];
+	size_t i, j, g;
+	std::vector<Stress> handoff;
+	std::vector<Stress> first_row;
+	
+	/* stress adds up on shared neighbours, so visit in row-major order */
+	for(uint32_t pos : border_set.sorted()) {
+		i = pos / size;
+		j = pos % size;
+		g = global_row(i);
+		if(g < 1 || g >= size-1 || j < 1 || j >= size-1) {
+			continue;
+		}
+
+		k = 0;
+		for(n = 0; n < N::size; ++n) {
+			cand[k] = n;
+			k += cells[i + N::offsets[n][0]][j + N::offsets[n][1]] == Cell::Healthy;
+		}
+		
+		if(k > 0) {
+			Rng::Block r = rng(step, global_pos(i, j), Purpose::Ecm);
+			n = cand[Rng::uniform_int(r[0], 0, k-1)];
+			x = N::offsets[n][0];
+			y = N::offsets[n][1];
+			
+			float stress = 0.1f * Rng::uniform(r[1]) * (dt / 20.0f);
+			if(!owned(i+x)) {
+				handoff.push_back({global_pos(i+x, j+y), stress});
+				continue;
+			}
+			if(domain && i+x == halo) {
+				first_row.push_back({global_pos(i+x, j+y), stress});
+				continue;
+			}
+			ecm_stress[i+x][j+y] += stress;
+			stressed_set.insert((i+x)*size + j+y);
+		}
 	}
 
-	float A = alpha2 * (static_cast<float>(cells[i][j] == Cell::Healthy) +
-					   	static_cast<float>(immune[i][j] == Cell::Immune) + 
-						lambda * static_cast<float>(cells[i][j] == Cell::Tumor)); 
+	if(domain) {
+		send_stress(handoff, first_row);
+	}
+}
 
-	float nabla2 = temp_float[i-1][j] + temp_float[i+1][j] + temp_float[i][j-1] + temp_float[i][j+1] - 4 * temp_float[i][j];
+void Sim::damage_ecm() {
+	(this->*rules.damage_ecm)();
+}
 
-	float r = temp_float[i][j];
-	float k1 = nabla2 - A*r;
-	float k2 = nabla2 - A*(r + diff_dt*k1/2);
-	float k3 = nabla2 - A*(r + diff_dt*k2/2);
-	float k4 = nabla2 - A*(r + diff_dt*k3);
+/* Cell an immune cell at (i, j) tries to move to: up the attractant
+ * gradient plus a random walk component. */
+void Sim::immune_target(size_t i, size_t j, size_t& x, size_t& y) {
+	float gx, gy, rndx, rndy, rnd_norm, vecx, vecy, angle;
+	int n_angle;
+	size_t g = global_row(i);
 
-	nutrient[i][j] = r + 1.0f/6.0f * diff_dt * (k1 + 2*k2 + 2*k3 + k4);;
+	if(g == 0) {
+		gx = attr[i+1][j] - attr[i][j];
+	} else if(g == size-1) {
+		gx = attr[i][j] - attr[i-1][j];
+	} else {
+		gx = (attr[i+1][j] - attr[i-1][j]) / 2;
+	}
 
-	if(nutrient[i][j] < 0.0f) {
-		nutrient[i][j] = 0.0f;
+	if(j == 0) {
+		gy = attr[i][j+1] - attr[i][j];
+	} else if(j == size-1) {
+		gy = attr[i][j] - attr[i][j-1];
+	} else {
+		gy = (attr[i][j+1] - attr[i][j-1]) / 2;
 	}
+	
+	Rng::Block r = rng(step, global_pos(i, j), Purpose::Move);
+	rndx = 2.0f * Rng::uniform(r[0]) - 1.0f;
+	rndy = 2.0f * Rng::uniform(r[1]) - 1.0f;
+	rnd_norm = std::sqrt(rndx*rndx + rndy*rndy) / imm_rnd;
+	rndx /= rnd_norm;
+	rndy /= rnd_norm;
+	
+	vecx = gx + rndx;
+	vecy = gy + rndy;
 
-	float diff = std::abs(nutrient[i][j] - temp_float[i][j]);
-	if(diff > max_diff) {
-		max_diff = diff;
+	angle = std::atan2(vecx, vecy);
+	n_angle = std::floor(angle / (M_PI / 8.0f));
+	
+	switch(n_angle) {
+		case 7:
+		case -8:
+			x = i; y = j-1; break;
+		case -7:
+		case -6:
+			x = i-1; y = j-1; break;
+		case -5:
+		case -4:
+			x = i-1; y = j; break;
+		case -3:
+		case -2:
+			x = i-1; y = j+1; break;
+		case -1:
+		case 0:
+			x = i; y = j+1; break;
+		case 1:
+		case 2:
+			x = i+1; y = j+1; break;
+		case 3:
+		case 4:
+			x = i+1; y = j; break;
+		case 5:
+		case 6:
+			x = i+1; y = j-1; break;
+		default:
+			x = i; y = j; break;
 	}
 }
 
-inline void Sim::diffuse_nutr(size_t i, size_t j, size_t i_m, size_t i_p, size_t j_m, size_t j_p, float& max_diff) {
-	if(cells[i][j] == Cell::Vessel) {
+void Sim::move_immune() {
+	if(parallel_move) {
+		move_immune_parallel();
 		return;
 	}
 
-	float A = alpha2 * (static_cast<float>(cells[i][j] == Cell::Healthy) +
-					   	static_cast<float>(immune[i][j] == Cell::Immune) + 
-						lambda * static_cast<float>(cells[i][j] == Cell::Tumor)); 
-
-	float nabla2 = temp_float[i_m][j] + temp_float[i_p][j] + temp_float[i][j_m] + temp_float[i][j_p] - 4 * temp_float[i][j];
+	size_t i, j, x, y;
+	std::vector<Coord> immune_cells;
+	std::vector<Emigrant> emigrants;
+	
+	immune_cells.reserve(immune_set.size());
+	for(uint32_t pos : immune_set.items()) {
+		immune_cells.push_back({pos / size, pos % size});
+	}
+	shuffle(immune_cells, Purpose::MoveOrder);
 
-	float r = temp_float[i][j];
-	float k1 = nabla2 - A*r;
-	float k2 = nabla2 - A*(r + diff_dt*k1/2);
-	float k3 = nabla2 - A*(r + diff_dt*k2/2);
-	float k4 = nabla2 - A*(r + diff_dt*k3);
+	for(auto const& c : immune_cells) {
+		i = c.x;
+		j = c.y;
+		immune_target(i, j, x, y);
 
-	nutrient[i][j] = r + 1.0f/6.0f * diff_dt * (k1 + 2*k2 + 2*k3 + k4);;
+		if(global_row(x) < size && y < size && !immune.test(x, y)) {
+			/* the cell stays until the owner of the target row takes it */
+			if(!owned(x)) {
+				emigrants.push_back({i*size + j, global_pos(x, y), order_key(i, j, Purpose::MoveOrder), kill_cnt[i][j], life_cnt[i][j]});
+				continue;
+			}
 
-	if(nutrient[i][j] < 0.0f) {
-		nutrient[i][j] = 0.0f;
+			mark_dirty(i, j);
+			mark_dirty(x, y);
+			immune_set.move(i*size + j, x*size + y);
+			immune.reset(i, j);
+			immune.set(x, y);
+			kill_cnt[x][y] = kill_cnt[i][j];
+			kill_cnt[i][j] = 0;
+			life_cnt[x][y] = life_cnt[i][j];
+			life_cnt[i][j] = 0;
+		}
 	}
 
-	float diff = std::abs(nutrient[i][j] - temp_float[i][j]);
-	if(diff > max_diff) {
-		max_diff = diff;
+	if(domain) {
+		send_immune(emigrants);
 	}
 }
 
-inline void Sim::diffuse_attr(size_t i, size_t j, float& max_diff) {
-	float A = beta2 * static_cast<float>(cells[i][j] == Cell::Tumor || cells[i][j] == Cell::DeadTumor);
-	float nabla2 = temp_float[i-1][j] + temp_float[i+1][j] + temp_float[i][j-1] + temp_float[i][j+1] - 4 * temp_float[i][j];
-	
-	attr[i][j] = temp_float[i][j] + diff_dt * (nabla2 + A);
-	
-	if(attr[i][j] < 0) {
-		attr[i][j] = 0;
-	}
-	
-	float diff = std::abs(attr[i][j] - temp_float[i][j]);
-	if(diff > max_diff) {
-		max_diff = diff;
-	}
-}
+/* Parallel migration: every immune cell proposes its target at once and
+ * conflicts are settled in rounds. In each round the pending cells whose
+ * target is free claim it and the lowest priority key wins, the same key
+ * the sequential mode orders cells by. A cell vacated in an earlier round
+ * keeps the key of the cell that left it and only takes claims of higher
+ * keys, which in the sequential order come after the move. Targets do not
+ * depend on the moves, so both modes move the same cells. Rounds end when
+ * nothing moves. */
+void Sim::move_immune_parallel() {
+	size_t n_threads = pool->size();
+	std::vector<std::vector<Mover>> movers(n_threads);
 
-void Sim::diffuse() {
-	float max_diff;
-	
-	/* Diffuse nutrient */
-	size_t n;
-	for(n = 0; n < 100000; ++n) {
-		std::memcpy(temp_float, nutrient, size * size * sizeof(float));
-		max_diff = 0.0f;
-		
-		/* diffuse left column (boundary conditions) */
-		for(size_t j = 0; j < size; ++j) {
-			diffuse_nutr(0, j, size-1, 1, j-1, j+1, max_diff);
-		}
+	struct alignas(64) Count {
+		size_t n;
+	};
+	std::vector<Count> moved(n_threads);
 
-		/* diffuse right column (boundary conditions) */
-		for(size_t j = 0; j < size; ++j) {
-			diffuse_nutr(size-1, j, size-2, 0, j-1, j+1, max_diff);
-		}
+	const std::vector<uint32_t>& agents = immune_set.items();
+	size_t n_agents = agents.size();
 
-		for(size_t i = 1; i < size-1; ++i) {
-			/* diffuse top row (boundary conditions) */
-			diffuse_nutr(i, 0, i-1, i+1, size-1, 1, max_diff);
+	pool->run([&](size_t tid) {
+		std::vector<Mover>& own = movers[tid];
+		size_t k0 = tid * n_agents / n_threads;
+		size_t k1 = (tid + 1) * n_agents / n_threads;
+		size_t x, y;
 
-			/* diffuse bottom row (boundary conditions) */
-			diffuse_nutr(i, size-1, i-1, i+1, size-2, 0, max_diff);
-			
-			for(size_t j = 1; j < size-1; ++j) {
-				diffuse_nutr(i, j, max_diff);
+		/* propose */
+		for(size_t k = k0; k < k1; ++k) {
+			uint64_t pos = agents[k];
+			size_t i = pos / size;
+			size_t j = pos % size;
+
+			immune_target(i, j, x, y);
+			if(x < size && y < size && (x != i || y != j)) {
+				own.push_back({i, j, x, y, static_cast<uint64_t>(rng(step, pos, Purpose::MoveOrder)[0]) << 32 | pos, false, false});
 			}
 		}
 
-		if(max_diff < 0.0000003) {
-			break;
-		}
-	}
+		for(;;) {
+			/* claim */
+			for(auto& m : own) {
+				if(!m.done && !immune.test(m.x, m.y) && m.key >= vacated[m.x][m.y]) {
+					std::atomic_ref<uint64_t> c(claim[m.x][m.y]);
+					uint64_t cur = c.load(std::memory_order_relaxed);
+					while(m.key < cur && !c.compare_exchange_weak(cur, m.key, std::memory_order_relaxed)) {}
+					m.claimed = true;
+				}
+			}
+			pool->barrier();
 
-	/* Diffuse attractant */
-	for(size_t n = 0; n < 100000; ++n) {
-		std::memcpy(temp_float, attr, size * size * sizeof(float));
-		max_diff = 0.0f;
-		
-		for(size_t i = 1; i < size-1; ++i) {
-			for(size_t j = 1; j < size-1; ++j) {
-				diffuse_attr(i, j, max_diff);
+			/* resolve, winners have distinct targets */
+			moved[tid].n = 0;
+			for(auto& m : own) {
+				if(m.claimed && claim[m.x][m.y] == m.key) {
+					immune.reset_atomic(m.i, m.j);
+					immune.set_atomic(m.x, m.y);
+					kill_cnt[m.x][m.y] = kill_cnt[m.i][m.j];
+					kill_cnt[m.i][m.j] = 0;
+					life_cnt[m.x][m.y] = life_cnt[m.i][m.j];
+					life_cnt[m.i][m.j] = 0;
+					vacated[m.i][m.j] = m.key;
+					m.done = true;
+					++moved[tid].n;
+				}
 			}
-		}
+			pool->barrier();
 
-		if(max_diff < 0.0000003) {
-			break;
-		}
-	}
-}
+			size_t total = 0;
+			for(size_t k = 0; k < n_threads; ++k) {
+				total += moved[k].n;
+			}
 
-void Sim::damage_ecm() {
-	int x, y;
-	int n;
-	std::vector<int> i_vec;
-	std::vector<int> j_vec;
-	std::uniform_real_distribution<float> dist_f(0.0f, 0.1f);
-	
-	for(size_t i = 1; i < size-1; ++i) {
-		for(size_t j = 1; j < size-1; ++j) {
-			if(cells[i][j] == Cell::Tumor) {
-				i_vec.clear();
-				j_vec.clear();
-				
-				for(int n = 0; n < nbrhood; ++n) {
-					x = nbr[n][0];
-					y = nbr[n][1];
-					
-					if(0 <= i+x && i+x < size && 0 <= j+x && j+x < size && cells[i+x][j+y] == Cell::Healthy) {
-						i_vec.push_back(x);
-						j_vec.push_back(y);
-					}
-				}
-				
-				if(!i_vec.empty()) {
-					std::uniform_int_distribution<int> dist_n(0, i_vec.size()-1);
-					n = dist_n(gen);
-					x = i_vec[n];
-					y = j_vec[n];
-					
-					ecm_stress[i+x][j+y] += dist_f(gen) * (dt / 20.0f);
+			for(auto& m : own) {
+				if(m.claimed) {
+					std::atomic_ref<uint64_t>(claim[m.x][m.y]).store(std::numeric_limits<uint64_t>::max(), std::memory_order_relaxed);
+					m.claimed = false;
 				}
 			}
+			if(total == 0) {
+				break;
+			}
+			pool->barrier();
 		}
-	}
-}
+	});
 
-void Sim::move_immune() {
-	size_t i, j, x, y;
-	std::vector<Coord> immune_cells;
-	float gx, gy, rndx, rndy, rnd_norm, vecx, vecy, angle;
-	int n_angle;
-	std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
-	
-	for(size_t n = 0; n < size; ++n) {
-		for(size_t m = 0; m < size; ++m) {
-			if(immune[n][m] == Cell::Immune) {
-				immune_cells.push_back({n, m});
+	std::vector<std::pair<uint32_t, uint32_t>> moves;
+	for(auto const& own : movers) {
+		for(auto const& m : own) {
+			if(m.done) {
+				vacated[m.i][m.j] = 0;
+				mark_dirty(m.i, m.j);
+				mark_dirty(m.x, m.y);
+				moves.push_back({m.i*size + m.j, m.x*size + m.y});
 			}
 		}
 	}
-	std::random_shuffle(immune_cells.begin(), immune_cells.end());
-
-	for(auto const& c : immune_cells) {
-		i = c.x;
-		j = c.y;
+	immune_set.move(moves);
+}
 
-		if(i == 0) {
-			gx = attr[i+1][j] - attr[i][j];
-		} else if(i == size-1) {
-			gx = attr[i][j] - attr[i-1][j];
-		} else {
-			gx = (attr[i+1][j] - attr[i-1][j]) / 2;
+/* A tumor cell is on the border while it has a healthy neighbour, which
+ * can change for the cell at (i, j) and every cell around it. */
+template<class N>
+void Sim::update_border_on(size_t i, size_t j) {
+	for(int n = -1; n < N::size; ++n) {
+		size_t x = n < 0 ? i : i + N::offsets[n][0];
+		size_t y = n < 0 ? j : j + N::offsets[n][1];
+		if(!owned(x) || y >= size) {
+			continue;
 		}
 
-		if(j == 0) {
-			gy = attr[i][j+1] - attr[i][j];
-		} else if(j == size-1) {
-			gy = attr[i][j] - attr[i][j-1];
-		} else {
-			gy = (attr[i][j+1] - attr[i][j-1]) / 2;
+		bool border = false;
+		if(cells[x][y] == Cell::Tumor) {
+			for(int m = 0; m < N::size && !border; ++m) {
+				size_t u = x + N::offsets[m][0];
+				size_t v = y + N::offsets[m][1];
+				border = global_row(u) < size && v < size && cells[u][v] == Cell::Healthy;
+			}
 		}
-		
-		rndx = dist(gen);
-		rndy = dist(gen);
-		rnd_norm = std::sqrt(rndx*rndx + rndy*rndy) / imm_rnd;
-		rndx /= rnd_norm;
-		rndy /= rnd_norm;
-		
-		vecx = gx + rndx;
-		vecy = gy + rndy;
 
-		angle = std::atan2(vecx, vecy);
-		n_angle = std::floor(angle / (M_PI / 8.0f));
-		
-		switch(n_angle) {
-			case 7:
-			case -8:
-				x = i; y = j-1; break;
-			case -7:
-			case -6:
-				x = i-1; y = j-1; break;
-			case -5:
-			case -4:
-				x = i-1; y = j; break;
-			case -3:
-			case -2:
-				x = i-1; y = j+1; break;
-			case -1:
-			case 0:
-				x = i; y = j+1; break;
-			case 1:
-			case 2:
-				x = i+1; y = j+1; break;
-			case 3:
-			case 4:
-				x = i+1; y = j; break;
-			case 5:
-			case 6:
-				x = i+1; y = j-1; break;
-			default:
-				x = i; y = j; break;
-		}
-
-		if(x >= 0 && x < size && y >= 0 && y < size && immune[x][y] == Cell::Empty) {
-			immune[i][j] = Cell::Empty;
-			immune[x][y] = Cell::Immune;
-			kill_cnt[x][y] = kill_cnt[i][j];
-			kill_cnt[i][j] = 0;
-			life_cnt[x][y] = life_cnt[i][j];
-			life_cnt[i][j] = 0;
+		if(border) {
+			border_set.insert(x*size + y);
+		} else {
+			border_set.erase(x*size + y);
 		}
 	}
 }
 
 inline void Sim::healthy_die(size_t i, size_t j) {
+	mark_dirty(i, j);
 	cells[i][j] = Cell::Empty;
 	ecm_stress[i][j] = 0.0f;
+	stressed_set.erase(i*size + j);
+	update_border(i, j);
+	--num_healthy;
 }
 
 inline void Sim::tumor_apoptosis(size_t i, size_t j) {
+	mark_dirty(i, j);
 	cells[i][j] = Cell::Empty;
 	prolif_cnt[i][j] = 0;
+	tumor_set.erase(i*size + j);
+	update_border(i, j);
+	if(in_window(i, j)) {
+		--num_tumor;
+	}
 }
 
 inline void Sim::tumor_necrosis(size_t i, size_t j) {
+	mark_dirty(i, j);
 	cells[i][j] = Cell::DeadTumor;
 	prolif_cnt[i][j] = 0;
+	tumor_set.erase(i*size + j);
+	update_border(i, j);
+	if(in_window(i, j)) {
+		--num_tumor;
+	}
+	++num_deadtumor;
 }
 
 inline void Sim::immune_die(size_t i, size_t j) {
-	immune[i][j] = Cell::Empty;
+	mark_dirty(i, j);
+	immune_set.erase(i*size + j);
+	immune.reset(i, j);
 	kill_cnt[i][j] = 0;
 	life_cnt[i][j] = 0;
+	--num_immune;
 }
 
 void Sim::kill_tumor() {
-	for(size_t i = 0; i < size; ++i) {
-		for(size_t j = 0; j < size; ++j) {
-			if(cells[i][j] == Cell::Tumor) {
-				if(immune[i][j] == Cell::Immune) {
-					tumor_apoptosis(i, j);
-					++kill_cnt[i][j];
-				} else if(nutrient[i][j] < nutr_surv_thr) {
-					tumor_necrosis(i, j);
-				}
-			}
+	/* killing erases from the set, iterate over a copy */
+	std::vector<uint32_t> tumor_cells = tumor_set.items();
+
+	for(uint32_t pos : tumor_cells) {
+		size_t i = pos / size;
+		size_t j = pos % size;
+
+		if(immune.test(i, j)) {
+			tumor_apoptosis(i, j);
+			++kill_cnt[i][j];
+		} else if(nutrient[i][j] < nutr_surv_thr) {
+			tumor_necrosis(i, j);
 		}
 	}
 }
 
 void Sim::kill_immune() {
-	for(size_t i = 0; i < size; ++i) {
-		for(size_t j = 0; j < size; ++j) {
-			if(immune[i][j] == Cell::Immune) {
-				++life_cnt[i][j];
-				if(kill_cnt[i][j] >= kill_limit || life_cnt[i][j] >= life_steps || nutrient[i][j] < nutr_surv_thr) {
-					immune_die(i, j);
+	std::vector<uint32_t> immune_cells = immune_set.items();
+
+	for(uint32_t pos : immune_cells) {
+		size_t i = pos / size;
+		size_t j = pos % size;
+
+		++life_cnt[i][j];
+		if(kill_cnt[i][j] >= kill_limit || life_cnt[i][j] >= life_steps || nutrient[i][j] < nutr_surv_thr) {
+			immune_die(i, j);
+		}
+	}
+}
+
+/* Tiles where a cell can start to starve this step: healthy cells are
+ * never created, so only where its nutrient changed. Those are the
+ * re-solved tiles and, on a coarsened field, the tiles around them,
+ * which interpolate from their field cells. */
+std::vector<uint8_t> Sim::fresh_tiles() {
+	if(use_multigrid) {
+		return std::vector<uint8_t>(tile_rows * tile_cols, 1);
+	}
+
+	std::vector<uint8_t> fresh = act_nutr;
+	if(coarsen > 1) {
+		long n_rows = static_cast<long>(tile_rows);
+		long n_cols = static_cast<long>(tile_cols);
+		for(long ti = 0; ti < n_rows; ++ti) {
+			for(long tj = 0; tj < n_cols; ++tj) {
+				for(long di = -1; di <= 1; ++di) {
+					for(long dj = -1; dj <= 1; ++dj) {
+						fresh[ti * n_cols + tj] |= act_nutr[(ti + di + n_rows) % n_rows * n_cols + (tj + dj + n_cols) % n_cols];
+					}
 				}
 			}
 		}
 	}
+	return fresh;
 }
 
+/* Healthy cells die from stress, which only builds up on the stressed
+ * set, or from starvation in the fresh tiles. */
 void Sim::kill_healthy() {
-	for(size_t i = 0; i < size; ++i) {
-		for(size_t j = 0; j < size; ++j) {
-			if(cells[i][j] == Cell::Healthy && (ecm_stress[i][j] >= stress_thr || nutrient[i][j] < nutr_surv_thr)) {
-				healthy_die(i, j);
+	std::vector<uint32_t> stressed = stressed_set.items();
+	std::vector<uint8_t> fresh = fresh_tiles();
+	size_t i0, i1, j0, j1;
+
+	for(uint32_t pos : stressed) {
+		size_t i = pos / size;
+		size_t j = pos % size;
+
+		if(cells[i][j] == Cell::Healthy && ecm_stress[i][j] >= stress_thr) {
+			healthy_die(i, j);
+		}
+	}
+
+	for(size_t t = 0; t < tile_rows * tile_cols; ++t) {
+		if(!fresh[t]) {
+			continue;
+		}
+
+		tile_bounds(t, i0, i1, j0, j1);
+		for(size_t i = i0 * coarsen; i < i1 * coarsen; ++i) {
+			for(size_t j = j0 * coarsen; j < j1 * coarsen; ++j) {
+				if(cells[i][j] == Cell::Healthy && nutrient[i][j] < nutr_surv_thr) {
+					healthy_die(i, j);
+				}
 			}
 		}
 	}
 }
 
-void Sim::proliferate() {
+/* kill_tumor, kill_immune and kill_healthy applied to one cell in that
+ * order, e.g. a tumor kill increments kill_cnt before the immune cell
+ * checks kill_limit */
+inline void Sim::update_cell(size_t i, size_t j) {
+	bool starving = nutrient[i][j] < nutr_surv_thr;
+
+	if(cells[i][j] == Cell::Tumor) {
+		if(immune.test(i, j)) {
+			tumor_apoptosis(i, j);
+			++kill_cnt[i][j];
+		} else if(starving) {
+			tumor_necrosis(i, j);
+		}
+	}
+
+	if(immune.test(i, j)) {
+		++life_cnt[i][j];
+		if(kill_cnt[i][j] >= kill_limit || life_cnt[i][j] >= life_steps || starving) {
+			immune_die(i, j);
+		}
+	}
+
+	if(cells[i][j] == Cell::Healthy && (ecm_stress[i][j] >= stress_thr || starving)) {
+		healthy_die(i, j);
+	}
+}
+
+/* Fused form of kill_tumor, kill_immune and kill_healthy. All of these
+ * rules only look at the cell itself, so one pass that applies them per
+ * cell gives the same result as running each phase on its own. The pass
+ * visits every cell a rule can apply to once: the fresh tiles row by
+ * row, then the tumor, immune and stressed cells outside them in
+ * lattice order. The counts follow from the kills as they happen. */
+void Sim::update_cells() {
+	std::vector<uint8_t> fresh = fresh_tiles();
+	size_t i0, i1, j0, j1;
+
+	/* kills erase from the sets, collect the rest before the sweep */
+	std::vector<uint32_t> rest;
+	for(const ActiveSet* set : {&tumor_set, &immune_set, &stressed_set}) {
+		for(uint32_t pos : set->items()) {
+			if(!fresh[tile_of(pos / size, pos % size)]) {
+				rest.push_back(pos);
+			}
+		}
+	}
+	std::sort(rest.begin(), rest.end());
+	rest.erase(std::unique(rest.begin(), rest.end()), rest.end());
+
+	for(size_t t = 0; t < tile_rows * tile_cols; ++t) {
+		if(!fresh[t]) {
+			continue;
+		}
+
+		tile_bounds(t, i0, i1, j0, j1);
+		for(size_t i = i0 * coarsen; i < i1 * coarsen; ++i) {
+			for(size_t j = j0 * coarsen; j < j1 * coarsen; ++j) {
+				update_cell(i, j);
+			}
+		}
+	}
+
+	for(uint32_t pos : rest) {
+		update_cell(pos / size, pos % size);
+	}
+}
+
+template<class N>
+void Sim::proliferate_on() {
 	int x, y;
-	int n;
-	size_t i, j;
-	std::vector<int> i_vec;
-	std::vector<int> j_vec;
+	int n, k;
+	int cand[N::size];
+	size_t i, j, g;
 	std::vector<Coord> tumor_cells;
-	std::uniform_int_distribution<int> dist_prolif(static_cast<int>(-2 * 60.0f / dt), static_cast<int>(2 * 60.0f / dt));
+	std::vector<Daughter> daughters;
+	int prolif_lo = static_cast<int>(-2 * 60.0f / dt);
+	int prolif_hi = static_cast<int>(2 * 60.0f / dt);
 
-	for(size_t i = 1; i < size-1; ++i) {
-		for(size_t j = 1; j < size-1; ++j) {
-			if(cells[i][j] == Cell::Tumor && nutrient[i][j] > nutr_prolif_thr) {
-				tumor_cells.push_back({i, j});
-			}
+	for(uint32_t pos : tumor_set.items()) {
+		i = pos / size;
+		j = pos % size;
+		g = global_row(i);
+		if(g >= 1 && g < size-1 && j >= 1 && j < size-1 && nutrient[i][j] > nutr_prolif_thr) {
+			tumor_cells.push_back({i, j});
 		}
 	}
-	std::random_shuffle(tumor_cells.begin(), tumor_cells.end());
+	shuffle(tumor_cells, Purpose::ProlifOrder);
 
 	for(auto const& c : tumor_cells) {
 		i = c.x;
 		j = c.y;
 		
-		++prolif_cnt[i][j];
+		/* saturates so the narrow counter cannot overflow while the cell waits for space */
+		if(prolif_cnt[i][j] < t_steps) {
+			++prolif_cnt[i][j];
+		}
 		if(prolif_cnt[i][j] >= t_steps) {
-			i_vec.clear();
-			j_vec.clear();
-			
-			for(int n = 0; n < nbrhood; ++n) {
-				x = nbr[n][0];
-				y = nbr[n][1];
-
-				if(0 <= i+x && i+x < size && 0 <= j+x && j+x < size && cells[i+x][j+y] == Cell::Empty) {
-					i_vec.push_back(x);
-					j_vec.push_back(y);
-				}
+			k = 0;
+			for(n = 0; n < N::size; ++n) {
+				cand[k] = n;
+				k += cells[i + N::offsets[n][0]][j + N::offsets[n][1]] == Cell::Empty;
 			}
 
-			if(!i_vec.empty()) {
-				std::uniform_int_distribution<int> dist_n(0, i_vec.size()-1);
-				n = dist_n(gen);
-				x = i_vec[n];
-				y = j_vec[n];
+			if(k > 0) {
+				Rng::Block r = rng(step, global_pos(i, j), Purpose::Prolif);
+				n = cand[Rng::uniform_int(r[0], 0, k-1)];
+				x = N::offsets[n][0];
+				y = N::offsets[n][1];
 
+				/* the parent waits for the owner of the target row */
+				if(!owned(i+x)) {
+					daughters.push_back({i*size + j, global_pos(i+x, j+y), order_key(i, j, Purpose::ProlifOrder),
+						static_cast<int16_t>(Rng::uniform_int(r[1], prolif_lo, prolif_hi)),
+						static_cast<int16_t>(Rng::uniform_int(r[2], prolif_lo, prolif_hi))});
+					continue;
+				}
+
+				mark_dirty(i+x, j+y);
 				cells[i+x][j+y] = Cell::Tumor;
-				prolif_cnt[i+x][j+y] = dist_prolif(gen);
-				prolif_cnt[i][j] = dist_prolif(gen);
+				if(in_window(i+x, j+y)) {
+					++num_tumor;
+				}
+				tumor_set.insert((i+x)*size + j+y);
+				update_border(i+x, j+y);
+				prolif_cnt[i+x][j+y] = Rng::uniform_int(r[1], prolif_lo, prolif_hi);
+				prolif_cnt[i][j] = Rng::uniform_int(r[2], prolif_lo, prolif_hi);
 			}
 		}
 	}
+
+	if(domain) {
+		send_daughters(daughters);
+	}
+}
+
+void Sim::proliferate() {
+	(this->*rules.proliferate)();
+}
+
+/* entry of the dispatch table for a neighbourhood */
+template<class N>
+Sim::Rules Sim::rules_for() {
+	return {&Sim::damage_ecm_on<N>, &Sim::proliferate_on<N>, &Sim::update_border_on<N>};
 }
 
 void Sim::recruit_immune() {
-	std::uniform_real_distribution<float> dist(0.0f, 1.0f);
 	float num, thr;
-	std::vector<Coord> vessels;
 	float ves_n;
 
-	vessels.clear();
-
-	for(size_t i = 0; i < size; ++i) {
-		for(size_t j = 0; j < size; ++j) {
-			if(cells[i][j] == Cell::Vessel) {
-				vessels.push_back({i, j});
-			}
-		}
-	}
-	
-	ves_n = vessels.size();
+	/* vessels never change after setup */
+	ves_n = total_vessels;
 	thr = (init_immune_ratio * size * size - num_immune) / ves_n;
 
 	for(auto v : vessels) {
-		num = dist(gen);
-		if((num <= thr) && (immune[v.x][v.y] == Cell::Empty)) {
-			immune[v.x][v.y] = Cell::Immune;
+		num = Rng::uniform(rng(step, global_pos(v.x, v.y), Purpose::Recruit)[0]);
+		if((num <= thr) && !immune.test(v.x, v.y)) {
+			mark_dirty(v.x, v.y);
+			immune_set.insert(v.x*size + v.y);
+			immune.set(v.x, v.y);
+			++num_immune;
 		}
 	}
 }
 
+/* Random visiting order: cells are sorted by a key drawn for this step,
+ * ties broken by position so the order does not depend on the input order. */
+void Sim::shuffle(std::vector<Coord>& cells_list, Purpose purpose) {
+	std::vector<std::pair<uint64_t, Coord>> keyed;
+	keyed.reserve(cells_list.size());
+
+	for(auto const& c : cells_list) {
+		keyed.push_back({order_key(c.x, c.y, purpose), c});
+	}
+	std::sort(keyed.begin(), keyed.end(), [](auto const& a, auto const& b) { return a.first < b.first; });
+
+	for(size_t k = 0; k < keyed.size(); ++k) {
+		cells_list[k] = keyed[k].second;
+	}
+}
+
+/* Key of the cell at (i, j) in the visiting order of this step */
+inline uint64_t Sim::order_key(size_t i, size_t j, Purpose purpose) {
+	uint64_t pos = global_pos(i, j);
+	return static_cast<uint64_t>(rng(step, pos, purpose)[0]) << 32 | pos;
+}
+
+/* all rules of one time step in their fixed order */
+void Sim::run_step() {
+	timed(Trace::DamageEcm, &Sim::damage_ecm);
+	timed(Trace::Diffuse, &Sim::diffuse);
+
+	timed(Trace::MoveImmune, &Sim::move_immune);
+	timed(Trace::RecruitImmune, &Sim::recruit_immune);
+	timed(Trace::UpdateCells, &Sim::update_cells);
+	timed(Trace::Proliferate, &Sim::proliferate);
+
+	if(domain) {
+		sync_strips();
+	}
+	tumor_history.push_back(num_tumor);
+}
+
+inline void Sim::timed(Trace::Phase phase, void (Sim::*rule)()) {
+	if(trace == nullptr) {
+		(this->*rule)();
+		return;
+	}
+
+	Trace::Clock::time_point t0 = Trace::Clock::now();
+	(this->*rule)();
+	trace->add(phase, Trace::Clock::now() - t0);
+}
+
+void Sim::next_step() {
+	if(check_counts) {
+		check_counters();
+	}
+	++step;
+
+	if(checkpoint_every > 0 && step % checkpoint_every == 0) {
+		checkpoint();
+	}
+}
+
+inline void Sim::tally(Cell cell, bool imm, size_t i, size_t j) {
+	if(imm) {
+		++num_immune;
+	}
+	switch(cell) {
+		case Cell::Healthy:
+			++num_healthy;
+			break;
+		case Cell::Tumor:
+			if(in_window(i, j)) {
+				++num_tumor;
+			}
+			break;
+		case Cell::DeadTumor:
+			++num_deadtumor;
+			break;
+		default:
+			break;
+	}
+}
+
 void Sim::count_cells() {
 	num_healthy = 0;
 	num_tumor = 0;
 	num_deadtumor = 0;
 	num_immune = 0;
 
-	for(size_t i = 0; i < size; ++i) {
+	for(size_t i = halo; i < rows - halo; ++i) {
 		for(size_t j = 0; j < size; ++j) {
-			if(immune[i][j] == Cell::Immune) {
-				++num_immune;
-			}
-			switch(cells[i][j]) {
-				case Cell::Healthy:
-					++num_healthy;
-					break;
-				case Cell::Tumor:
-					if(j < 70) {
-						++num_tumor;
-					}
-					break;
-				case Cell::DeadTumor:
-					++num_deadtumor;
-					break;
-				default:
-					break;
-			}
+			tally(cells[i][j], immune.test(i, j), i, j);
 		}
 	}
+
+	/* the counters always hold the numbers of the whole lattice */
+	if(domain) {
+		int64_t n[4] = {num_healthy, num_tumor, num_deadtumor, num_immune};
+		domain->sum(n, 4);
+		num_healthy = static_cast<int>(n[0]);
+		num_tumor = static_cast<int>(n[1]);
+		num_deadtumor = static_cast<int>(n[2]);
+		num_immune = static_cast<int>(n[3]);
+	}
+	synced[0] = num_healthy;
+	synced[1] = num_tumor;
+	synced[2] = num_deadtumor;
+	synced[3] = num_immune;
+}
+
+/* debug mode: the counters kept by the state transitions must match a full recount */
+void Sim::check_counters() {
+	int healthy = num_healthy;
+	int tumor = num_tumor;
+	int deadtumor = num_deadtumor;
+	int immune_n = num_immune;
+
+	count_cells();
+	if(healthy != num_healthy || tumor != num_tumor || deadtumor != num_deadtumor || immune_n != num_immune) {
+		std::cerr << "Cell counters out of sync at step " << step << ": healthy " << healthy << "/" << num_healthy
+			<< ", tumor " << tumor << "/" << num_tumor << ", dead tumor " << deadtumor << "/" << num_deadtumor
+			<< ", immune " << immune_n << "/" << num_immune << std::endl;
+		throw std::logic_error("cell counters");
+	}
 }
 
 bool Sim::tumor_killed() {
 	return num_tumor == 0;
 }
+
+/* distance of the outermost tumor cell to the closest edge */
+size_t Sim::tumor_margin() const {
+	size_t margin = size;
+	for(uint32_t pos : tumor_set.items()) {
+		size_t i = global_row(pos / size);
+		size_t j = pos % size;
+		margin = std::min({margin, i, j, size - 1 - i, size - 1 - j});
+	}
+
+	if(domain) {
+		uint64_t m = margin;
+		domain->min(&m, 1);
+		margin = static_cast<size_t>(m);
+	}
+	return margin;
+}
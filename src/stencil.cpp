@@ -0,0 +1,379 @@
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+#include <immintrin.h>
+#include "stencil.h"
+
+/* scalar loops, also used for the tails of the vector kernels where they
+ * get inlined so no SSE/AVX transition happens inside a row */
+template<class L>
+static inline __attribute__((always_inline)) float nutr_span(float* out, const float* up, const float* mid, const float* down,
+		const float* absorb, const uint8_t* fixed, size_t n, float dt) {
+	float max_diff = 0.0f;
+
+	for(size_t j = 0; j < n; ++j) {
+		float v = Stencil::nutr_step(laplacian<L>(up, mid, down, j), mid[j], absorb[j], dt);
+		out[j] = fixed[j] ? mid[j] : v;
+		max_diff = std::max(max_diff, std::abs(out[j] - mid[j]));
+	}
+
+	return max_diff;
+}
+
+template<class L>
+static inline __attribute__((always_inline)) float attr_span(float* out, const float* up, const float* mid, const float* down,
+		const float* source, const uint8_t* fixed, size_t n, float dt) {
+	float max_diff = 0.0f;
+
+	for(size_t j = 0; j < n; ++j) {
+		float v = Stencil::attr_step(laplacian<L>(up, mid, down, j), mid[j], source[j], dt);
+		out[j] = fixed[j] ? mid[j] : v;
+		max_diff = std::max(max_diff, std::abs(out[j] - mid[j]));
+	}
+
+	return max_diff;
+}
+
+/* a single cell at column 1 of three-cell rows */
+template<class L>
+static float nutr_cell(const float* up, const float* mid, const float* down, float absorb, float dt) {
+	return Stencil::nutr_step(laplacian<L>(up, mid, down, 1), mid[1], absorb, dt);
+}
+
+template<class L>
+static float attr_cell(const float* up, const float* mid, const float* down, float source, float dt) {
+	return Stencil::attr_step(laplacian<L>(up, mid, down, 1), mid[1], source, dt);
+}
+
+/* plain loops the compiler vectorises for the target of the caller */
+static inline __attribute__((always_inline)) float extrapolate_span(float* out, const float* cur, const float* prev, size_t n,
+		float omega, float gamma) {
+	float max_val = 0.0f;
+
+	for(size_t j = 0; j < n; ++j) {
+		float v = std::max(prev[j] + omega * (cur[j] + gamma * (out[j] - cur[j]) - prev[j]), 0.0f);
+		out[j] = v;
+		max_val = std::max(max_val, v);
+	}
+
+	return max_val;
+}
+
+static inline __attribute__((always_inline)) float max_span(const float* u, size_t n) {
+	float max_val = 0.0f;
+
+	for(size_t j = 0; j < n; ++j) {
+		max_val = std::max(max_val, u[j]);
+	}
+
+	return max_val;
+}
+
+static float extrapolate_scalar(float* out, const float* cur, const float* prev, size_t n, float omega, float gamma) {
+	return extrapolate_span(out, cur, prev, n, omega, gamma);
+}
+
+static float row_max_scalar(const float* u, size_t n) {
+	return max_span(u, n);
+}
+
+template<class L>
+static float nutr_row_scalar(float* out, const float* up, const float* mid, const float* down,
+		const float* absorb, const uint8_t* fixed, size_t n, float dt) {
+	return nutr_span<L>(out, up, mid, down, absorb, fixed, n, dt);
+}
+
+template<class L>
+static float attr_row_scalar(float* out, const float* up, const float* mid, const float* down,
+		const float* source, const uint8_t* fixed, size_t n, float dt) {
+	return attr_span<L>(out, up, mid, down, source, fixed, n, dt);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("avx2")))
+static float extrapolate_avx2(float* out, const float* cur, const float* prev, size_t n, float omega, float gamma) {
+	return extrapolate_span(out, cur, prev, n, omega, gamma);
+}
+
+__attribute__((target("avx2")))
+static float row_max_avx2(const float* u, size_t n) {
+	return max_span(u, n);
+}
+
+/* laplacian() on 8 columns from j */
+template<class L>
+__attribute__((target("avx2")))
+static inline __m256 laplacian_avx2(const float* up, const float* mid, const float* down, size_t j, __m256 r) {
+	__m256 sum = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_loadu_ps(up + j), _mm256_loadu_ps(down + j)),
+				_mm256_loadu_ps(mid + j - 1)), _mm256_loadu_ps(mid + j + 1));
+
+	if constexpr(L::edge != 1.0f) {
+		sum = _mm256_mul_ps(_mm256_set1_ps(L::edge), sum);
+	}
+	if constexpr(L::corner[0]) {
+		sum = _mm256_add_ps(sum, _mm256_loadu_ps(up + j - 1));
+	}
+	if constexpr(L::corner[1]) {
+		sum = _mm256_add_ps(sum, _mm256_loadu_ps(up + j + 1));
+	}
+	if constexpr(L::corner[2]) {
+		sum = _mm256_add_ps(sum, _mm256_loadu_ps(down + j - 1));
+	}
+	if constexpr(L::corner[3]) {
+		sum = _mm256_add_ps(sum, _mm256_loadu_ps(down + j + 1));
+	}
+	sum = _mm256_sub_ps(sum, _mm256_mul_ps(_mm256_set1_ps(L::centre), r));
+
+	if constexpr(L::scale != 1.0f) {
+		sum = _mm256_mul_ps(_mm256_set1_ps(L::scale), sum);
+	}
+	return sum;
+}
+
+template<class L>
+__attribute__((target("avx2")))
+static float nutr_row_avx2(float* out, const float* up, const float* mid, const float* down,
+		const float* absorb, const uint8_t* fixed, size_t n, float dt) {
+	const __m256 v_dt = _mm256_set1_ps(dt);
+	const __m256 v_dt6 = _mm256_set1_ps(1.0f/6.0f * dt);
+	const __m256 v_half = _mm256_set1_ps(0.5f);
+	const __m256 v_two = _mm256_set1_ps(2.0f);
+	const __m256 v_zero = _mm256_setzero_ps();
+	const __m256 v_sign = _mm256_set1_ps(-0.0f);
+	__m256 v_max = _mm256_setzero_ps();
+	size_t j = 0;
+
+	for(; j + 8 <= n; j += 8) {
+		__m256 r = _mm256_loadu_ps(mid + j);
+		__m256 A = _mm256_loadu_ps(absorb + j);
+		__m256 nabla2 = laplacian_avx2<L>(up, mid, down, j, r);
+
+		__m256 k1 = _mm256_sub_ps(nabla2, _mm256_mul_ps(A, r));
+		__m256 k2 = _mm256_sub_ps(nabla2, _mm256_mul_ps(A, _mm256_add_ps(r, _mm256_mul_ps(_mm256_mul_ps(v_dt, k1), v_half))));
+		__m256 k3 = _mm256_sub_ps(nabla2, _mm256_mul_ps(A, _mm256_add_ps(r, _mm256_mul_ps(_mm256_mul_ps(v_dt, k2), v_half))));
+		__m256 k4 = _mm256_sub_ps(nabla2, _mm256_mul_ps(A, _mm256_add_ps(r, _mm256_mul_ps(v_dt, k3))));
+		__m256 sum = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(k1, _mm256_mul_ps(v_two, k2)), _mm256_mul_ps(v_two, k3)), k4);
+		__m256 v = _mm256_max_ps(_mm256_add_ps(r, _mm256_mul_ps(v_dt6, sum)), v_zero);
+
+		/* vessels keep their value */
+		__m256i m = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(fixed + j)));
+		__m256 keep = _mm256_castsi256_ps(_mm256_cmpgt_epi32(m, _mm256_setzero_si256()));
+		v = _mm256_blendv_ps(v, r, keep);
+
+		_mm256_storeu_ps(out + j, v);
+		v_max = _mm256_max_ps(v_max, _mm256_andnot_ps(v_sign, _mm256_sub_ps(v, r)));
+	}
+
+	float lanes[8];
+	_mm256_storeu_ps(lanes, v_max);
+	float max_diff = *std::max_element(lanes, lanes + 8);
+
+	return std::max(max_diff, nutr_span<L>(out + j, up + j, mid + j, down + j, absorb + j, fixed + j, n - j, dt));
+}
+
+template<class L>
+__attribute__((target("avx2")))
+static float attr_row_avx2(float* out, const float* up, const float* mid, const float* down,
+		const float* source, const uint8_t* fixed, size_t n, float dt) {
+	const __m256 v_dt = _mm256_set1_ps(dt);
+	const __m256 v_zero = _mm256_setzero_ps();
+	const __m256 v_sign = _mm256_set1_ps(-0.0f);
+	__m256 v_max = _mm256_setzero_ps();
+	size_t j = 0;
+
+	for(; j + 8 <= n; j += 8) {
+		__m256 r = _mm256_loadu_ps(mid + j);
+		__m256 nabla2 = laplacian_avx2<L>(up, mid, down, j, r);
+
+		__m256 v = _mm256_add_ps(r, _mm256_mul_ps(v_dt, _mm256_add_ps(nabla2, _mm256_loadu_ps(source + j))));
+		v = _mm256_max_ps(v, v_zero);
+
+		__m256i m = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(fixed + j)));
+		v = _mm256_blendv_ps(v, r, _mm256_castsi256_ps(_mm256_cmpgt_epi32(m, _mm256_setzero_si256())));
+
+		_mm256_storeu_ps(out + j, v);
+		v_max = _mm256_max_ps(v_max, _mm256_andnot_ps(v_sign, _mm256_sub_ps(v, r)));
+	}
+
+	float lanes[8];
+	_mm256_storeu_ps(lanes, v_max);
+	float max_diff = *std::max_element(lanes, lanes + 8);
+
+	return std::max(max_diff, attr_span<L>(out + j, up + j, mid + j, down + j, source + j, fixed + j, n - j, dt));
+}
+
+/* GCC 12 warns about the undefined pass-through operand inside its AVX-512 headers */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+__attribute__((target("avx512f")))
+static float extrapolate_avx512(float* out, const float* cur, const float* prev, size_t n, float omega, float gamma) {
+	return extrapolate_span(out, cur, prev, n, omega, gamma);
+}
+
+__attribute__((target("avx512f")))
+static float row_max_avx512(const float* u, size_t n) {
+	return max_span(u, n);
+}
+
+/* laplacian() on 16 columns from j */
+template<class L>
+__attribute__((target("avx512f")))
+static inline __m512 laplacian_avx512(const float* up, const float* mid, const float* down, size_t j, __m512 r) {
+	__m512 sum = _mm512_add_ps(_mm512_add_ps(_mm512_add_ps(_mm512_loadu_ps(up + j), _mm512_loadu_ps(down + j)),
+				_mm512_loadu_ps(mid + j - 1)), _mm512_loadu_ps(mid + j + 1));
+
+	if constexpr(L::edge != 1.0f) {
+		sum = _mm512_mul_ps(_mm512_set1_ps(L::edge), sum);
+	}
+	if constexpr(L::corner[0]) {
+		sum = _mm512_add_ps(sum, _mm512_loadu_ps(up + j - 1));
+	}
+	if constexpr(L::corner[1]) {
+		sum = _mm512_add_ps(sum, _mm512_loadu_ps(up + j + 1));
+	}
+	if constexpr(L::corner[2]) {
+		sum = _mm512_add_ps(sum, _mm512_loadu_ps(down + j - 1));
+	}
+	if constexpr(L::corner[3]) {
+		sum = _mm512_add_ps(sum, _mm512_loadu_ps(down + j + 1));
+	}
+	sum = _mm512_sub_ps(sum, _mm512_mul_ps(_mm512_set1_ps(L::centre), r));
+
+	if constexpr(L::scale != 1.0f) {
+		sum = _mm512_mul_ps(_mm512_set1_ps(L::scale), sum);
+	}
+	return sum;
+}
+
+template<class L>
+__attribute__((target("avx512f")))
+static float nutr_row_avx512(float* out, const float* up, const float* mid, const float* down,
+		const float* absorb, const uint8_t* fixed, size_t n, float dt) {
+	const __m512 v_dt = _mm512_set1_ps(dt);
+	const __m512 v_dt6 = _mm512_set1_ps(1.0f/6.0f * dt);
+	const __m512 v_half = _mm512_set1_ps(0.5f);
+	const __m512 v_two = _mm512_set1_ps(2.0f);
+	const __m512 v_zero = _mm512_setzero_ps();
+	__m512 v_max = _mm512_setzero_ps();
+	size_t j = 0;
+
+	for(; j + 16 <= n; j += 16) {
+		__m512 r = _mm512_loadu_ps(mid + j);
+		__m512 A = _mm512_loadu_ps(absorb + j);
+		__m512 nabla2 = laplacian_avx512<L>(up, mid, down, j, r);
+
+		__m512 k1 = _mm512_sub_ps(nabla2, _mm512_mul_ps(A, r));
+		__m512 k2 = _mm512_sub_ps(nabla2, _mm512_mul_ps(A, _mm512_add_ps(r, _mm512_mul_ps(_mm512_mul_ps(v_dt, k1), v_half))));
+		__m512 k3 = _mm512_sub_ps(nabla2, _mm512_mul_ps(A, _mm512_add_ps(r, _mm512_mul_ps(_mm512_mul_ps(v_dt, k2), v_half))));
+		__m512 k4 = _mm512_sub_ps(nabla2, _mm512_mul_ps(A, _mm512_add_ps(r, _mm512_mul_ps(v_dt, k3))));
+		__m512 sum = _mm512_add_ps(_mm512_add_ps(_mm512_add_ps(k1, _mm512_mul_ps(v_two, k2)), _mm512_mul_ps(v_two, k3)), k4);
+		__m512 v = _mm512_max_ps(_mm512_add_ps(r, _mm512_mul_ps(v_dt6, sum)), v_zero);
+
+		/* vessels keep their value */
+		__m512i m = _mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(fixed + j)));
+		v = _mm512_mask_blend_ps(_mm512_test_epi32_mask(m, m), v, r);
+
+		_mm512_storeu_ps(out + j, v);
+		v_max = _mm512_max_ps(v_max, _mm512_abs_ps(_mm512_sub_ps(v, r)));
+	}
+
+	float lanes[16];
+	_mm512_storeu_ps(lanes, v_max);
+	float max_diff = *std::max_element(lanes, lanes + 16);
+
+	return std::max(max_diff, nutr_span<L>(out + j, up + j, mid + j, down + j, absorb + j, fixed + j, n - j, dt));
+}
+
+template<class L>
+__attribute__((target("avx512f")))
+static float attr_row_avx512(float* out, const float* up, const float* mid, const float* down,
+		const float* source, const uint8_t* fixed, size_t n, float dt) {
+	const __m512 v_dt = _mm512_set1_ps(dt);
+	const __m512 v_zero = _mm512_setzero_ps();
+	__m512 v_max = _mm512_setzero_ps();
+	size_t j = 0;
+
+	for(; j + 16 <= n; j += 16) {
+		__m512 r = _mm512_loadu_ps(mid + j);
+		__m512 nabla2 = laplacian_avx512<L>(up, mid, down, j, r);
+
+		__m512 v = _mm512_add_ps(r, _mm512_mul_ps(v_dt, _mm512_add_ps(nabla2, _mm512_loadu_ps(source + j))));
+		v = _mm512_max_ps(v, v_zero);
+
+		__m512i m = _mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(fixed + j)));
+		v = _mm512_mask_blend_ps(_mm512_test_epi32_mask(m, m), v, r);
+
+		_mm512_storeu_ps(out + j, v);
+		v_max = _mm512_max_ps(v_max, _mm512_abs_ps(_mm512_sub_ps(v, r)));
+	}
+
+	float lanes[16];
+	_mm512_storeu_ps(lanes, v_max);
+	float max_diff = *std::max_element(lanes, lanes + 16);
+
+	return std::max(max_diff, attr_span<L>(out + j, up + j, mid + j, down + j, source + j, fixed + j, n - j, dt));
+}
+
+#pragma GCC diagnostic pop
+
+#endif
+
+/* Kernels of one neighbourhood, the AVX2 and AVX-512 rows are
+ * instantiated with its Laplacian like the scalar ones */
+template<class L>
+static Stencil kernels(const std::string& isa) {
+#if defined(__x86_64__) || defined(__i386__)
+	if(isa == "avx512") {
+		return {nutr_row_avx512<L>, attr_row_avx512<L>, extrapolate_avx512, row_max_avx512, "avx512",
+			nutr_cell<L>, attr_cell<L>, L::size, L::spread, L::mode};
+	}
+	if(isa == "avx2") {
+		return {nutr_row_avx2<L>, attr_row_avx2<L>, extrapolate_avx2, row_max_avx2, "avx2",
+			nutr_cell<L>, attr_cell<L>, L::size, L::spread, L::mode};
+	}
+#endif
+
+	return {nutr_row_scalar<L>, attr_row_scalar<L>, extrapolate_scalar, row_max_scalar, "scalar",
+			nutr_cell<L>, attr_cell<L>, L::size, L::spread, L::mode};
+}
+
+Stencil Stencil::select(const std::string& isa, int neighbours) {
+	bool avx512 = false;
+	bool avx2 = false;
+
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	avx512 = __builtin_cpu_supports("avx512f");
+	avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+	if(isa != "auto" && isa != "avx512" && isa != "avx2" && isa != "scalar") {
+		std::cerr << "Unknown simd '" << isa << "'." << std::endl;
+		throw std::invalid_argument("simd");
+	}
+	if((isa == "avx512" && !avx512) || (isa == "avx2" && !avx2)) {
+		std::cerr << "Instruction set '" << isa << "' not supported by this CPU." << std::endl;
+		throw std::invalid_argument("simd");
+	}
+
+	std::string use = "scalar";
+	if(avx512 && (isa == "auto" || isa == "avx512")) {
+		use = "avx512";
+	} else if(avx2 && (isa == "auto" || isa == "avx2")) {
+		use = "avx2";
+	}
+
+	switch(neighbours) {
+		case 4:
+			return kernels<VonNeumann>(use);
+		case 6:
+			return kernels<Hexagonal>(use);
+		case 8:
+			return kernels<Moore>(use);
+		default:
+			std::cerr << "diff_neighbourhood must be 4, 6 or 8." << std::endl;
+			throw std::invalid_argument("diff_neighbourhood");
+	}
+}
@@ -0,0 +1,16 @@
+#include <iostream>
+#include "ensemble.h"
+
+/* Replicates and parameter sweeps of the sweep group in the configuration */
+int main(int argc, char** argv)
+{
+	if(argc > 2) {
+		std::cerr << "usage: " << argv[0] << " [config.cfg]" << std::endl;
+		return 1;
+	}
+
+	Ensemble ensemble(argc == 2 ? argv[1] : "../config.cfg");
+	ensemble.run();
+
+	return 0;
+}
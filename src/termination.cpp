@@ -0,0 +1,153 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+#include "settings.h"
+#include "termination.h"
+
+namespace {
+	/* no tumor cells left, the rule the simulation always had */
+	class TumorKilled : public StopCondition {
+		public:
+			explicit TumorKilled(const libconfig::Setting&) {}
+
+			bool stop(const Observation& obs) const override {
+				return obs.num_tumor == 0;
+			}
+	};
+
+	/* the tumor has grown to within margin cells of the lattice edge */
+	class Boundary : public StopCondition {
+		public:
+			explicit Boundary(const libconfig::Setting& setting) {
+				read_setting<int>(setting, "margin", margin);
+			}
+
+			bool stop(const Observation& obs) const override {
+				return obs.num_tumor > 0 && obs.tumor_margin <= static_cast<size_t>(std::max(margin, 0));
+			}
+
+			bool needs_margin() const override { return true; }
+
+		private:
+			int margin;
+	};
+
+	/* num_tumor varied by at most tolerance (relative) over the last window steps */
+	class Plateau : public StopCondition {
+		public:
+			explicit Plateau(const libconfig::Setting& setting) {
+				read_setting<int>(setting, "window", window);
+				read_setting<float>(setting, "tolerance", tolerance);
+				read_setting<int>(setting, "after", after);
+				if(window < 1) {
+					std::cerr << "The plateau window must be positive." << std::endl;
+					throw std::invalid_argument("window");
+				}
+			}
+
+			bool stop(const Observation& obs) const override {
+				const std::vector<int>& h = *obs.tumor_history;
+				if(obs.step < static_cast<uint64_t>(std::max(after, 0)) || h.size() <= static_cast<size_t>(window)) {
+					return false;
+				}
+				auto range = std::minmax_element(h.end() - window - 1, h.end());
+				return *range.second - *range.first <= tolerance * std::max(*range.second, 1);
+			}
+
+		private:
+			int window;
+			float tolerance;
+			int after;
+	};
+
+	/* Mean exponential growth rate of num_tumor over the last window
+	 * steps, per hour. Below min_rate the tumor is controlled, above
+	 * max_rate it escapes. */
+	class Growth : public StopCondition {
+		public:
+			explicit Growth(const libconfig::Setting& setting) {
+				read_setting<int>(setting, "window", window);
+				read_setting<float>(setting, "min_rate", min_rate);
+				read_setting<float>(setting, "max_rate", max_rate);
+				read_setting<int>(setting, "after", after);
+				if(window < 1 || min_rate > max_rate) {
+					std::cerr << "The growth window must be positive and min_rate at most max_rate." << std::endl;
+					throw std::invalid_argument("window");
+				}
+			}
+
+			bool stop(const Observation& obs) const override {
+				const std::vector<int>& h = *obs.tumor_history;
+				if(obs.step < static_cast<uint64_t>(std::max(after, 0)) || h.size() <= static_cast<size_t>(window)) {
+					return false;
+				}
+				int then = h[h.size() - window - 1];
+				int now = h.back();
+				if(then <= 0 || now <= 0) {
+					return false;
+				}
+				float rate = std::log(static_cast<float>(now) / then) / (window * obs.step_hours);
+				return rate < min_rate || rate > max_rate;
+			}
+
+		private:
+			int window;
+			float min_rate;
+			float max_rate;
+			int after;
+	};
+
+	template<class C>
+	std::unique_ptr<StopCondition> make(const libconfig::Setting& setting) {
+		return std::make_unique<C>(setting);
+	}
+}
+
+std::map<std::string, ConditionFactory>& Termination::types() {
+	static std::map<std::string, ConditionFactory> registry = {
+		{"tumor_killed", make<TumorKilled>},
+		{"boundary", make<Boundary>},
+		{"plateau", make<Plateau>},
+		{"growth", make<Growth>}
+	};
+	return registry;
+}
+
+void Termination::add_type(const std::string& type, ConditionFactory factory) {
+	types()[type] = std::move(factory);
+}
+
+Termination::Termination(const libconfig::Config& cfg, const Sim& sim) : margin(false), which(-1) {
+	const libconfig::Setting& list = cfg.getRoot()["termination"];
+
+	for(int k = 0; k < list.getLength(); ++k) {
+		std::string type;
+		read_setting<std::string>(list[k], "type", type);
+
+		auto it = types().find(type);
+		if(it == types().end()) {
+			std::cerr << "Unknown termination type '" << type << "'." << std::endl;
+			throw std::invalid_argument("termination");
+		}
+		conditions.push_back(it->second(list[k]));
+		reasons.push_back(type);
+		margin = margin || conditions.back()->needs_margin();
+	}
+}
+
+bool Termination::update(const Sim& sim) {
+	size_t tumor_margin = margin ? sim.tumor_margin() : sim.size;
+
+	Observation obs = {sim.step, sim.dt / 60.0f, sim.num_healthy, sim.num_tumor, sim.num_deadtumor,
+		sim.num_immune, tumor_margin, &sim.tumor_history};
+
+	for(size_t k = 0; k < conditions.size(); ++k) {
+		if(conditions[k]->stop(obs)) {
+			which = static_cast<int>(k);
+			return true;
+		}
+	}
+
+	return false;
+}
@@ -0,0 +1,73 @@
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool(size_t n_threads) :
+	n_threads(n_threads), sync(static_cast<std::ptrdiff_t>(n_threads)),
+	job(nullptr), generation(0), pending(0), stop(false)
+{
+	for(size_t tid = 1; tid < n_threads; ++tid) {
+		workers.emplace_back(&ThreadPool::worker, this, tid);
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		stop = true;
+	}
+	cv_start.notify_all();
+
+	for(auto& w : workers) {
+		w.join();
+	}
+}
+
+void ThreadPool::run(const std::function<void(size_t)>& fn) {
+	if(n_threads == 1) {
+		fn(0);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		job = &fn;
+		pending = n_threads - 1;
+		++generation;
+	}
+	cv_start.notify_all();
+
+	fn(0);
+
+	std::unique_lock<std::mutex> lock(mtx);
+	cv_done.wait(lock, [this] { return pending == 0; });
+	job = nullptr;
+}
+
+void ThreadPool::barrier() {
+	if(n_threads > 1) {
+		sync.arrive_and_wait();
+	}
+}
+
+void ThreadPool::worker(size_t tid) {
+	size_t seen = 0;
+
+	for(;;) {
+		const std::function<void(size_t)>* fn;
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			cv_start.wait(lock, [&] { return stop || generation != seen; });
+			if(stop) {
+				return;
+			}
+			seen = generation;
+			fn = job;
+		}
+
+		(*fn)(tid);
+
+		std::lock_guard<std::mutex> lock(mtx);
+		if(--pending == 0) {
+			cv_done.notify_one();
+		}
+	}
+}
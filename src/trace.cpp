@@ -0,0 +1,123 @@
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include "settings.h"
+#include "sim.h"
+#include "trace.h"
+
+Trace::Trace(const libconfig::Config& cfg, Sim& sim) :
+	sim(sim), on(false), binary(false), rec{}, steps(0), total{}, worst{},
+	nutr_iter(0), attr_iter(0), max_nutr_iter(0), max_attr_iter(0), nutr_capped(0), attr_capped(0)
+{
+	std::string file, format;
+	read_setting<std::string>(cfg.getRoot(), "trace_file", file);
+	read_setting<std::string>(cfg.getRoot()["parameters"], "trace_format", format);
+
+	if(format != "csv" && format != "binary") {
+		std::cerr << "Unknown trace_format '" << format << "'." << std::endl;
+		throw std::invalid_argument("trace_format");
+	}
+	if(file.empty()) {
+		return;
+	}
+
+	binary = format == "binary";
+	out.open(file, binary ? std::ios::binary | std::ios::trunc : std::ios::trunc);
+	if(!out) {
+		std::cerr << "Cannot create trace file '" << file << "'." << std::endl;
+		throw std::runtime_error("trace");
+	}
+
+	if(binary) {
+		out.write("CASIMTR1", 8);
+	} else {
+		out << "step";
+		for(int p = 0; p < n_phases; ++p) {
+			out << "," << name(static_cast<Phase>(p));
+		}
+		out << ",nutr_iter,nutr_res,nutr_capped,attr_iter,attr_res,attr_capped\n";
+	}
+
+	on = true;
+	sim.trace = this;
+}
+
+Trace::~Trace() {
+	if(on) {
+		sim.trace = nullptr;
+		summary();
+	}
+}
+
+const char* Trace::name(Phase phase) {
+	static const char* names[n_phases] = {
+		"damage_ecm", "diffuse", "move_immune", "recruit_immune", "update_cells", "proliferate", "log"
+	};
+	return names[phase];
+}
+
+void Trace::end_step() {
+	if(!on) {
+		return;
+	}
+
+	rec.step = sim.step;
+	rec.nutr_iter = sim.nutr_iter;
+	rec.nutr_res = sim.nutr_res;
+	rec.attr_iter = sim.attr_iter;
+	rec.attr_res = sim.attr_res;
+	rec.nutr_capped = sim.nutr_capped;
+	rec.attr_capped = sim.attr_capped;
+
+	if(binary) {
+		out.write(reinterpret_cast<const char*>(&rec), sizeof(rec));
+	} else {
+		out << rec.step;
+		for(int p = 0; p < n_phases; ++p) {
+			out << "," << rec.seconds[p];
+		}
+		out << "," << rec.nutr_iter << "," << rec.nutr_res << "," << int(rec.nutr_capped)
+			<< "," << rec.attr_iter << "," << rec.attr_res << "," << int(rec.attr_capped) << "\n";
+	}
+
+	++steps;
+	for(int p = 0; p < n_phases; ++p) {
+		total[p] += rec.seconds[p];
+		worst[p] = std::max(worst[p], rec.seconds[p]);
+		rec.seconds[p] = 0.0f;
+	}
+	nutr_iter += rec.nutr_iter;
+	attr_iter += rec.attr_iter;
+	max_nutr_iter = std::max(max_nutr_iter, rec.nutr_iter);
+	max_attr_iter = std::max(max_attr_iter, rec.attr_iter);
+	nutr_capped += rec.nutr_capped;
+	attr_capped += rec.attr_capped;
+}
+
+void Trace::summary() {
+	if(steps == 0) {
+		return;
+	}
+
+	double all = 0.0;
+	for(int p = 0; p < n_phases; ++p) {
+		all += total[p];
+	}
+
+	std::cout << "phase            total [s]  mean [ms]   max [ms]   share" << std::endl;
+	std::cout << std::fixed;
+	for(int p = 0; p < n_phases; ++p) {
+		std::cout << std::left << std::setw(15) << name(static_cast<Phase>(p)) << std::right
+			<< std::setprecision(3) << std::setw(12) << total[p]
+			<< std::setw(11) << 1000.0 * total[p] / steps
+			<< std::setw(11) << 1000.0 * worst[p]
+			<< std::setprecision(1) << std::setw(7) << (all > 0.0 ? 100.0 * total[p] / all : 0.0) << "%" << std::endl;
+	}
+	std::cout << std::defaultfloat << std::setprecision(6);
+	std::cout << steps << " steps, " << all << " s" << std::endl;
+	std::cout << "nutrient solver: " << static_cast<double>(nutr_iter) / steps << " mean, " << max_nutr_iter
+		<< " max iterations, " << nutr_capped << " steps short of the tolerance" << std::endl;
+	std::cout << "attractant solver: " << static_cast<double>(attr_iter) / steps << " mean, " << max_attr_iter
+		<< " max iterations, " << attr_capped << " steps short of the tolerance" << std::endl;
+}
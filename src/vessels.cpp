@@ -0,0 +1,80 @@
+#include <cstdio>
+#include <fstream>
+#include "sim.h"
+
+/* Vessel layout: a fixed header and the positions i*size + j of all
+ * vessels in row-major order. A layout written once can be read by any
+ * number of later runs, of one process or of several, so replicates
+ * share the vasculature and skip its placement. */
+namespace {
+	constexpr char vessel_magic[8] = {'C', 'A', 'S', 'I', 'M', 'V', 'S', '1'};
+
+	struct VesselHeader {
+		char magic[8];
+		uint64_t size;
+		uint64_t count;
+	};
+}
+
+std::vector<uint64_t> Sim::load_vessels(const std::string& path) {
+	std::ifstream in(path, std::ios::binary | std::ios::ate);
+	if(!in) {
+		std::cerr << "Cannot open vessel layout '" << path << "'." << std::endl;
+		throw std::runtime_error("vessel_load_file");
+	}
+	size_t bytes = static_cast<size_t>(in.tellg());
+	in.seekg(0);
+
+	VesselHeader header;
+	if(bytes < sizeof(header) || !in.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+		std::cerr << "Vessel layout '" << path << "' is truncated." << std::endl;
+		throw std::runtime_error("vessel_load_file");
+	}
+	if(std::memcmp(header.magic, vessel_magic, sizeof(vessel_magic)) != 0) {
+		std::cerr << "'" << path << "' is not a vessel layout." << std::endl;
+		throw std::runtime_error("vessel_load_file");
+	}
+	if(header.size != size) {
+		std::cerr << "Vessel layout '" << path << "' was written for size = " << header.size << "." << std::endl;
+		throw std::runtime_error("vessel_load_file");
+	}
+	if(header.count != (bytes - sizeof(header)) / sizeof(uint64_t) || (bytes - sizeof(header)) % sizeof(uint64_t) != 0) {
+		std::cerr << "Vessel layout '" << path << "' is truncated." << std::endl;
+		throw std::runtime_error("vessel_load_file");
+	}
+
+	std::vector<uint64_t> pos(header.count);
+	in.read(reinterpret_cast<char*>(pos.data()), static_cast<std::streamsize>(pos.size() * sizeof(uint64_t)));
+	for(uint64_t p : pos) {
+		if(p >= static_cast<uint64_t>(size) * size) {
+			std::cerr << "Vessel layout '" << path << "' has a vessel outside the lattice." << std::endl;
+			throw std::runtime_error("vessel_load_file");
+		}
+	}
+	return pos;
+}
+
+/* the vessels of the run, after a restart those of the checkpoint */
+void Sim::save_vessels(const std::string& path) {
+	std::vector<uint64_t> pos;
+	for(auto const& v : vessels) {
+		pos.push_back(global_pos(v.x, v.y));
+	}
+
+	VesselHeader header;
+	std::memcpy(header.magic, vessel_magic, sizeof(vessel_magic));
+	header.size = size;
+	header.count = pos.size();
+
+	/* readers never see a partly written layout */
+	std::string tmp = path + ".tmp";
+	std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	out.write(reinterpret_cast<const char*>(pos.data()), static_cast<std::streamsize>(pos.size() * sizeof(uint64_t)));
+	out.close();
+
+	if(!out || std::rename(tmp.c_str(), path.c_str()) != 0) {
+		std::cerr << "Writing vessel layout '" << path << "' failed." << std::endl;
+		throw std::runtime_error("vessel_save_file");
+	}
+}
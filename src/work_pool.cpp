@@ -0,0 +1,70 @@
+#include <exception>
+#include <thread>
+#include "work_pool.h"
+
+WorkPool::WorkPool(size_t n_threads) : n_threads(n_threads) {
+	for(size_t tid = 0; tid < n_threads; ++tid) {
+		queues.push_back(std::make_unique<Queue>());
+	}
+}
+
+void WorkPool::run(size_t n_tasks, const std::function<void(size_t, size_t)>& fn) {
+	/* deal the tasks round robin, so every thread starts with early ones */
+	for(size_t task = n_tasks; task-- > 0; ) {
+		queues[task % n_threads]->tasks.push_back(task);
+	}
+
+	std::vector<std::exception_ptr> errors(n_threads);
+	std::vector<std::thread> threads;
+	for(size_t tid = 1; tid < n_threads; ++tid) {
+		threads.emplace_back(&WorkPool::worker, this, tid, std::cref(fn), std::ref(errors[tid]));
+	}
+	worker(0, fn, errors[0]);
+
+	for(auto& t : threads) {
+		t.join();
+	}
+	for(auto& e : errors) {
+		if(e) {
+			std::rethrow_exception(e);
+		}
+	}
+}
+
+/* no task creates others, so empty deques everywhere mean the run is over */
+bool WorkPool::take(size_t tid, size_t& task) {
+	{
+		Queue& own = *queues[tid];
+		std::lock_guard<std::mutex> lock(own.mtx);
+		if(!own.tasks.empty()) {
+			task = own.tasks.back();
+			own.tasks.pop_back();
+			return true;
+		}
+	}
+
+	for(size_t k = 1; k < n_threads; ++k) {
+		Queue& victim = *queues[(tid + k) % n_threads];
+		std::lock_guard<std::mutex> lock(victim.mtx);
+		if(!victim.tasks.empty()) {
+			task = victim.tasks.front();
+			victim.tasks.pop_front();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void WorkPool::worker(size_t tid, const std::function<void(size_t, size_t)>& fn, std::exception_ptr& error) {
+	size_t task;
+	while(take(tid, task)) {
+		try {
+			fn(task, tid);
+		} catch(...) {
+			/* keep the first failure and leave the remaining tasks to the others */
+			error = std::current_exception();
+			return;
+		}
+	}
+}
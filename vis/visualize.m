@@ -2,6 +2,17 @@ close all
 clear variables
 load('data_mat.mat');
 
+% undo the optional output encodings
+if exist('delta_cells', 'var') && delta_cells
+    cells = cumsum(double(cells), 3);
+    immune = cumsum(double(immune), 3);
+end
+if exist('quantize_bits', 'var') && quantize_bits > 0
+    nutrient = double(nutrient) .* reshape(quant_scale(:, 1), 1, 1, []) + reshape(quant_offset(:, 1), 1, 1, []);
+    attr = double(attr) .* reshape(quant_scale(:, 2), 1, 1, []) + reshape(quant_offset(:, 2), 1, 1, []);
+    ecm_stress = double(ecm_stress) .* reshape(quant_scale(:, 3), 1, 1, []) + reshape(quant_offset(:, 3), 1, 1, []);
+end
+
 n = 5;
 dims = [1, 1;
         1, 2;